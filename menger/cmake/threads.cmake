@@ -0,0 +1,2 @@
+FIND_PACKAGE(Threads REQUIRED)
+LIST(APPEND stdgl_libraries ${CMAKE_THREAD_LIBS_INIT})
@@ -0,0 +1,1275 @@
+#include "bench.h"
+
+#include "fastmath.h"
+#include "fluid.h"
+#include "heightfield.h"
+#include "menger.h"
+#include "meshcache.h"
+#include "meshio.h"
+#include "meshlet.h"
+#include "meshopt.h"
+#include "meshpack.h"
+#include "packets.h"
+#include "ship.h"
+#include "sphere.h"
+#include "spectral.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+    // Best wall time of `reps` runs, in milliseconds
+    double time_ms(int reps, const std::function<void(void)>& fn) {
+        double best = -1;
+        for (int i = 0; i < reps; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+            if (best < 0 || took.count() < best) {
+                best = took.count();
+            }
+        }
+        return best;
+    }
+
+    void menger_generation(void) {
+        std::cout << "menger generation (best of 3, ms)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(12) << "cubes"
+            << std::setw(12) << "recursive" << std::setw(12) << "iterative"
+            << std::setw(10) << "speedup" << std::setw(12) << "max diff" << std::endl;
+        Menger menger;
+        std::vector<glm::vec4> rec_vertices, vertices;
+        std::vector<glm::uvec3> rec_faces, faces;
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            double rec = time_ms(3, [&]() { menger.generate_geometry_recursive(rec_vertices, rec_faces); });
+            double it = time_ms(3, [&]() { menger.generate_geometry(vertices, faces); });
+
+            float diff = 0.0f;
+            bool same_faces = rec_faces == faces;
+            for (size_t i = 0; i < vertices.size() && i < rec_vertices.size(); ++i) {
+                diff = std::max(diff, glm::length(vertices[i] - rec_vertices[i]));
+            }
+            std::cout << std::setw(6) << level << std::setw(12) << Menger::cube_count(level)
+                << std::fixed << std::setprecision(3)
+                << std::setw(12) << rec << std::setw(12) << it
+                << std::setw(9) << std::setprecision(1) << rec / it << "x"
+                << std::setw(12) << std::scientific << std::setprecision(1) << diff
+                << (same_faces && vertices.size() == rec_vertices.size() ? "" : "  MISMATCH")
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    void menger_culling(void) {
+        std::cout << "menger hidden face culling (triangles)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(12) << "all"
+            << std::setw(12) << "visible" << std::setw(10) << "kept"
+            << std::setw(12) << "ms" << std::endl;
+        Menger menger;
+        menger.set_cull_hidden(true);
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            double ms = time_ms(3, [&]() { menger.generate_geometry(vertices, faces); });
+            size_t all = Menger::cube_count(level) * 12;
+            std::cout << std::setw(6) << level << std::setw(12) << all
+                << std::setw(12) << faces.size()
+                << std::fixed << std::setprecision(1)
+                << std::setw(9) << 100.0 * faces.size() / all << "%"
+                << std::setw(12) << std::setprecision(3) << ms
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    void menger_welding(void) {
+        std::cout << "menger vertex welding (vertices)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(12) << "plain"
+            << std::setw(12) << "welded" << std::setw(12) << "ms"
+            << std::setw(14) << "welded+culled" << std::setw(12) << "ms" << std::endl;
+        Menger menger;
+        menger.set_weld_vertices(true);
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.set_cull_hidden(false);
+            double ms = time_ms(3, [&]() { menger.generate_geometry(vertices, faces); });
+            size_t welded = vertices.size();
+            menger.set_cull_hidden(true);
+            double culled_ms = time_ms(3, [&]() { menger.generate_geometry(vertices, faces); });
+            std::cout << std::setw(6) << level << std::setw(12) << Menger::cube_count(level) * 8
+                << std::setw(12) << welded
+                << std::fixed << std::setprecision(3) << std::setw(12) << ms
+                << std::setw(14) << vertices.size() << std::setw(12) << culled_ms
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    template <typename T>
+    bool same_bytes(const std::vector<T>& a, const std::vector<T>& b) {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+    }
+
+    void menger_parallel(void) {
+#ifdef _OPENMP
+        std::cout << "menger parallel generation (" << omp_get_max_threads() << " threads, best of 3, ms)" << std::endl;
+#else
+        std::cout << "menger parallel generation (built without OpenMP, best of 3, ms)" << std::endl;
+#endif
+        std::cout << std::setw(6) << "level" << std::setw(8) << "culled" << std::setw(8) << "welded"
+            << std::setw(12) << "serial" << std::setw(12) << "parallel"
+            << std::setw(10) << "speedup" << std::setw(12) << "identical" << std::endl;
+        Menger menger;
+        std::vector<glm::vec4> serial_vertices, vertices;
+        std::vector<glm::uvec3> serial_faces, faces;
+        for (int weld = 0; weld < 2; ++weld) {
+            for (int cull = 0; cull < 2; ++cull) {
+                menger.set_weld_vertices(weld);
+                menger.set_cull_hidden(cull);
+                for (int level = 3; level <= 4; ++level) {
+                    menger.set_nesting_level(level);
+                    menger.set_parallel(false);
+                    double serial = time_ms(3, [&]() { menger.generate_geometry(serial_vertices, serial_faces); });
+                    menger.set_parallel(true);
+                    double parallel = time_ms(3, [&]() { menger.generate_geometry(vertices, faces); });
+                    bool identical = same_bytes(serial_vertices, vertices) && same_bytes(serial_faces, faces);
+                    std::cout << std::setw(6) << level << std::setw(8) << (cull ? "yes" : "no")
+                        << std::setw(8) << (weld ? "yes" : "no") << std::fixed << std::setprecision(3)
+                        << std::setw(12) << serial << std::setw(12) << parallel
+                        << std::setw(9) << std::setprecision(1) << serial / parallel << "x"
+                        << std::setw(12) << (identical ? "yes" : "NO")
+                        << std::defaultfloat << std::endl;
+                }
+            }
+        }
+    }
+
+    void menger_instancing(void) {
+        std::cout << "menger instancing (GPU bytes)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(14) << "mesh"
+            << std::setw(14) << "instanced" << std::setw(10) << "ratio" << std::endl;
+        Menger menger;
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        std::vector<glm::u16vec4> cells;
+        Menger::unit_cube(vertices, faces);
+        const size_t cube_bytes = vertices.size() * sizeof(glm::vec4) + faces.size() * sizeof(glm::uvec3);
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.generate_geometry(vertices, faces);
+            menger.generate_instances(cells);
+            size_t mesh = vertices.size() * sizeof(glm::vec4) + faces.size() * sizeof(glm::uvec3);
+            size_t instanced = cells.size() * sizeof(glm::u16vec4) + cube_bytes;
+            std::cout << std::setw(6) << level << std::setw(14) << mesh << std::setw(14) << instanced
+                << std::fixed << std::setprecision(1) << std::setw(9) << double(mesh) / instanced << "x"
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    // Signed volume enclosed by a triangle mesh. It only comes out right for
+    // a closed, consistently outward wound surface.
+    double enclosed_volume(const std::vector<glm::vec4>& vertices, const std::vector<glm::uvec3>& faces) {
+        double volume = 0.0;
+        for (const auto& f : faces) {
+            glm::dvec3 a(vertices[f[0]]), b(vertices[f[1]]), c(vertices[f[2]]);
+            volume += glm::dot(a, glm::cross(b, c)) / 6.0;
+        }
+        return volume;
+    }
+
+    // Whether every edge, matched by vertex position, is walked once each way
+    // by the triangles on either side. An edge ending partway along another
+    // (a T-junction) leaves both unmatched.
+    bool watertight(const std::vector<glm::vec4>& vertices, const std::vector<glm::uvec3>& faces) {
+        std::map<std::tuple<float, float, float>, unsigned int> ids;
+        std::vector<unsigned int> id(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            id[i] = ids.emplace(std::make_tuple(vertices[i][0], vertices[i][1], vertices[i][2]), ids.size()).first->second;
+        }
+        std::map<std::pair<unsigned int, unsigned int>, int> edges;
+        for (const auto& f : faces) {
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int a = id[f[k]], b = id[f[(k + 1) % 3]];
+                if (a < b) ++edges[std::make_pair(a, b)];
+                else --edges[std::make_pair(b, a)];
+            }
+        }
+        return std::all_of(edges.begin(), edges.end(), [](const std::pair<const std::pair<unsigned int, unsigned int>, int>& e) {
+            return e.second == 0;
+        });
+    }
+
+    void menger_merging(void) {
+        std::cout << "menger face merging (ms, best of 3)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(12) << "culled"
+            << std::setw(12) << "merged" << std::setw(10) << "ratio"
+            << std::setw(10) << "ms" << std::setw(10) << "volume" << std::setw(12) << "watertight" << std::endl;
+        Menger menger;
+        menger.set_cull_hidden(true);
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> culled, merged;
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.set_merge_faces(false);
+            menger.generate_geometry(vertices, culled);
+            menger.set_merge_faces(true);
+            double ms = time_ms(3, [&]() { menger.generate_geometry(vertices, merged); });
+            double expected = std::pow(20.0 / 27.0, level);
+            bool closed = std::abs(enclosed_volume(vertices, merged) - expected) < 1e-4;
+            std::cout << std::setw(6) << level << std::setw(12) << culled.size() << std::setw(12) << merged.size()
+                << std::fixed << std::setprecision(1) << std::setw(9) << double(culled.size()) / merged.size() << "x"
+                << std::setprecision(2) << std::setw(10) << ms
+                << std::setw(10) << (closed ? "ok" : "WRONG")
+                << std::setw(12) << (watertight(vertices, merged) ? "yes" : "NO")
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    // Regenerating vs mapping the cache file, which only checks its header;
+    // identical also verifies the content hash. The ship row is only filled
+    // in when boat.obj is in the working directory.
+    void mesh_cache(void) {
+        std::cout << "mesh cache (best of 3, ms)" << std::endl;
+        std::cout << std::setw(10) << "mesh" << std::setw(14) << "bytes"
+            << std::setw(12) << "generate" << std::setw(10) << "mapped"
+            << std::setw(10) << "speedup" << std::setw(12) << "identical" << std::endl;
+        auto report = [](const std::string& name, size_t bytes, double generate, double mapped, bool identical) {
+            std::cout << std::setw(10) << name << std::setw(14) << bytes
+                << std::fixed << std::setprecision(2) << std::setw(12) << generate << std::setw(10) << mapped
+                << std::setprecision(1) << std::setw(9) << generate / mapped << "x"
+                << std::setw(12) << (identical ? "yes" : "NO") << std::defaultfloat << std::endl;
+        };
+
+        // plain cubes at every level, then the slower variants at level 4
+        struct variant { int level; bool cull, weld, merge; };
+        const std::vector<variant> variants = {
+            {0, false, false, false}, {1, false, false, false}, {2, false, false, false},
+            {3, false, false, false}, {4, false, false, false}, {4, true, false, false},
+            {4, true, true, false}, {4, true, false, true}, {4, true, true, true}
+        };
+        Menger menger;
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        for (const auto& v : variants) {
+            menger.set_nesting_level(v.level);
+            menger.set_cull_hidden(v.cull);
+            menger.set_weld_vertices(v.weld);
+            menger.set_merge_faces(v.merge);
+            double generate = time_ms(3, [&]() { menger.generate_geometry(vertices, faces); });
+            menger.save_cached(vertices, faces);
+            double mapped = time_ms(3, [&]() { menger.map_cached(); });
+            meshcache::mapped_mesh mesh = menger.map_cached();
+            bool identical = mesh.verify() && mesh.vertex_count() == vertices.size() && mesh.face_count() == faces.size()
+                && std::memcmp(mesh.vertices(), vertices.data(), vertices.size() * sizeof(glm::vec4)) == 0
+                && std::memcmp(mesh.faces(), faces.data(), faces.size() * sizeof(glm::uvec3)) == 0;
+            std::string name = "menger " + std::to_string(v.level) + (v.cull ? "c" : "") + (v.weld ? "w" : "") + (v.merge ? "m" : "");
+            report(name, vertices.size() * sizeof(glm::vec4) + faces.size() * sizeof(glm::uvec3), generate, mapped, identical);
+        }
+
+        std::ifstream boat("boat.obj");
+        if (!boat.good()) return;
+        std::remove(meshcache::path("ship").c_str());
+        std::vector<glm::vec4> normals, cached_vertices, cached_normals;
+        std::vector<glm::uvec3> cached_faces;
+        double parse = time_ms(1, [&]() { ship::generate_geometry(vertices, faces, normals); });
+        double mapped = time_ms(3, [&]() { ship::generate_geometry(cached_vertices, cached_faces, cached_normals); });
+        report("ship", vertices.size() * sizeof(glm::vec4) + faces.size() * sizeof(glm::uvec3), parse, mapped,
+            cached_vertices == vertices && cached_faces == faces && cached_normals == normals);
+    }
+
+    // The original exporter, kept here as the baseline
+    void save_obj_stream(const std::string& file,
+            const std::vector<glm::vec4>& vertices, const std::vector<glm::uvec3>& indices) {
+        std::ofstream fout;
+        fout.open(file);
+        for(const auto& v: vertices)
+            fout << "v " << v[0] << " " << v[1] << " " << v[2] << std::endl;
+        for(const auto& f: indices)
+            fout << "f " << (1+f[0]) << " " << (1+f[1]) << " " << (1+f[2]) << std::endl;
+    }
+
+    // Parses back what format_float wrote and reports the worst error
+    float float_format_error(void) {
+        float worst = 0.0f;
+        char text[32];
+        for (int i = -200000; i <= 200000; ++i) {
+            float value = i * 0.0137f;
+            *meshio::format_float(text, value) = '\0';
+            worst = std::max(worst, std::abs(std::strtof(text, nullptr) - value));
+        }
+        return worst;
+    }
+
+    void obj_export(void) {
+        std::cout << "obj export (best of 3, ms; float format max error "
+            << float_format_error() << ")" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(12) << "bytes"
+            << std::setw(12) << "ofstream" << std::setw(12) << "meshio"
+            << std::setw(10) << "speedup" << std::endl;
+        Menger menger;
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        const std::string file = "bench_export.obj";
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.generate_geometry(vertices, faces);
+            double stream = time_ms(level < 4 ? 3 : 1, [&]() { save_obj_stream(file, vertices, faces); });
+            double fast = time_ms(3, [&]() { meshio::save_obj(file, vertices, faces); });
+            std::ifstream written(file, std::ios::binary | std::ios::ate);
+            std::cout << std::setw(6) << level << std::setw(12) << written.tellg()
+                << std::fixed << std::setprecision(2) << std::setw(12) << stream << std::setw(12) << fast
+                << std::setprecision(1) << std::setw(9) << stream / fast << "x"
+                << std::defaultfloat << std::endl;
+        }
+        std::remove(file.c_str());
+    }
+
+    void export_formats(void) {
+        std::cout << "export formats (best of 3, bytes and ms)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(12) << "obj" << std::setw(10) << "ms"
+            << std::setw(12) << "ply" << std::setw(10) << "ms"
+            << std::setw(12) << "stl" << std::setw(10) << "ms" << std::endl;
+        Menger menger;
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        const std::vector<std::string> files = {"bench_export.obj", "bench_export.ply", "bench_export.stl"};
+        for (int level = 0; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.generate_geometry(vertices, faces);
+            std::cout << std::setw(6) << level;
+            for (const auto& file : files) {
+                double ms = time_ms(3, [&]() {
+                    meshio::save(file, vertices.data(), vertices.size(), faces.data(), faces.size());
+                });
+                std::ifstream written(file, std::ios::binary | std::ios::ate);
+                std::cout << std::setw(12) << written.tellg()
+                    << std::fixed << std::setprecision(2) << std::setw(10) << ms << std::defaultfloat;
+                std::remove(file.c_str());
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    // The original boat parser (v/t/n triangles only), kept as the baseline
+    void load_obj_stream(const std::string& file, std::vector<glm::vec4>& verts, std::vector<glm::uvec3>& faces) {
+        std::string line_buf;
+        std::ifstream boat(file);
+        std::vector<glm::vec4> norms;
+        std::vector<glm::vec2> tex_coord;
+        while (!boat.eof()) {
+            getline(boat, line_buf);
+            std::stringstream ss;
+            if (line_buf.compare(0, 2, "v ") == 0) {
+                ss << line_buf.substr(2);
+                float x, y, z;
+                ss >> x >> y >> z;
+                verts.push_back(glm::vec4(x, y, z, 1.0f));
+            } else if (line_buf.compare(0, 3, "vn ") == 0) {
+                ss << line_buf.substr(3);
+                float x, y, z;
+                ss >> x >> y >> z;
+                norms.push_back(glm::vec4(x, y, z, 0.0f));
+            } else if (line_buf.compare(0, 3, "vt ") == 0) {
+                ss << line_buf.substr(3);
+                float u, v;
+                ss >> u >> v;
+                tex_coord.push_back(glm::vec2(u, v));
+            } else if (line_buf.compare(0, 2, "f ") == 0) {
+                ss << line_buf.substr(2);
+                unsigned int v0, n0, t0, v1, n1, t1, v2, n2, t2;
+                char tossaway;
+                ss >> v0 >> tossaway >> t0 >> tossaway >> n0
+                    >> v1 >> tossaway >> t1 >> tossaway >> n1
+                    >> v2 >> tossaway >> t2 >> tossaway >> n2;
+                faces.push_back(glm::uvec3(v0, v1, v2) - glm::uvec3(1.0));
+            }
+        }
+    }
+
+    // Reading the whole file into memory, as the bandwidth to aim for
+    double read_ms(const std::string& file) {
+        std::vector<char> data;
+        return time_ms(3, [&]() {
+            std::ifstream in(file, std::ios::binary | std::ios::ate);
+            data.resize(in.tellg());
+            in.seekg(0);
+            in.read(data.data(), data.size());
+        });
+    }
+
+    void obj_import(void) {
+        std::cout << "obj import (best of 3, ms)" << std::endl;
+        std::cout << std::setw(10) << "file" << std::setw(12) << "bytes" << std::setw(10) << "read"
+            << std::setw(10) << "stream" << std::setw(10) << "meshio" << std::setw(10) << "MB/s"
+            << std::setw(10) << "match" << std::endl;
+        auto report = [](const std::string& name, size_t bytes, double read, double stream, double fast, bool match) {
+            std::cout << std::setw(10) << name << std::setw(12) << bytes
+                << std::fixed << std::setprecision(2) << std::setw(10) << read;
+            if (stream >= 0) {
+                std::cout << std::setw(10) << stream;
+            } else {
+                std::cout << std::setw(10) << "-";
+            }
+            std::cout << std::setw(10) << fast << std::setprecision(0) << std::setw(10) << bytes / fast / 1e3
+                << std::setw(10) << (match ? "yes" : "NO") << std::defaultfloat << std::endl;
+        };
+
+        // Menger exports: plain "f a b c" triangles, no normals
+        Menger menger;
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        meshio::obj_mesh mesh;
+        const std::string file = "bench_import.obj";
+        for (int level = 2; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.set_weld_vertices(true);
+            menger.generate_geometry(vertices, faces);
+            meshio::save_obj(file, vertices, faces);
+            std::ifstream written(file, std::ios::binary | std::ios::ate);
+            double fast = time_ms(3, [&]() { meshio::load_obj(file, mesh); });
+            float diff = 0.0f;
+            bool match = mesh.vertices.size() == vertices.size() && mesh.faces == faces;
+            for (size_t i = 0; match && i < vertices.size(); ++i) {
+                diff = std::max(diff, glm::length(mesh.vertices[i] - vertices[i]));
+            }
+            report("menger " + std::to_string(level), written.tellg(), read_ms(file), -1, fast, match && diff < 1e-5f);
+        }
+        std::remove(file.c_str());
+
+        std::ifstream boat("boat.obj", std::ios::binary | std::ios::ate);
+        if (!boat.good()) return;
+        double stream = time_ms(3, [&]() {
+            vertices.clear();
+            faces.clear();
+            load_obj_stream("boat.obj", vertices, faces);
+        });
+        double fast = time_ms(3, [&]() { meshio::load_obj("boat.obj", mesh); });
+        // the new loader splits positions by normal, so compare the triangles' corners
+        bool match = faces.size() == mesh.faces.size();
+        for (size_t i = 0; match && i < faces.size(); ++i) {
+            for (int k = 0; k < 3; ++k) {
+                match = match && glm::length(vertices[faces[i][k]] - mesh.vertices[mesh.faces[i][k]]) < 1e-5f;
+            }
+        }
+        report("boat", boat.tellg(), read_ms("boat.obj"), stream, fast, match);
+    }
+
+    // Triangles with their winding kept, rotated so the smallest index is first
+    std::vector<glm::uvec3> canonical_faces(const std::vector<glm::uvec3>& faces) {
+        std::vector<glm::uvec3> out;
+        out.reserve(faces.size());
+        for (const auto& f : faces) {
+            if (f[1] < f[0] && f[1] < f[2]) {
+                out.push_back(glm::uvec3(f[1], f[2], f[0]));
+            } else if (f[2] < f[0] && f[2] < f[1]) {
+                out.push_back(glm::uvec3(f[2], f[0], f[1]));
+            } else {
+                out.push_back(f);
+            }
+        }
+        std::sort(out.begin(), out.end(), [](const glm::uvec3& a, const glm::uvec3& b) {
+            return std::lexicographical_compare(&a[0], &a[0] + 3, &b[0], &b[0] + 3);
+        });
+        return out;
+    }
+
+    void mesh_optimization(void) {
+        std::cout << "mesh optimization (ACMR at FIFO " << meshopt::kCacheSize << ", ms)" << std::endl;
+        std::cout << std::setw(12) << "mesh" << std::setw(12) << "triangles"
+            << std::setw(10) << "before" << std::setw(10) << "after"
+            << std::setw(10) << "ms" << std::setw(10) << "same" << std::endl;
+        auto report = [](const std::string& name, std::vector<glm::vec4> vertices, std::vector<glm::uvec3> faces) {
+            const std::vector<glm::vec4> original_vertices = vertices;
+            const std::vector<glm::uvec3> original_faces = faces;
+            const float before = meshopt::acmr(faces, vertices.size());
+            std::vector<unsigned int> new_index;
+            double ms = time_ms(1, [&]() { new_index = meshopt::optimize(vertices, faces); });
+            // Same triangles and vertices once the remap is undone
+            std::vector<unsigned int> old_index(new_index.size());
+            for (size_t i = 0; i < new_index.size(); ++i) old_index[new_index[i]] = i;
+            bool same = vertices.size() == original_vertices.size();
+            for (size_t i = 0; same && i < vertices.size(); ++i) {
+                same = vertices[i] == original_vertices[old_index[i]];
+            }
+            std::vector<glm::uvec3> restored(faces.size());
+            for (size_t i = 0; i < faces.size(); ++i) {
+                for (int k = 0; k < 3; ++k) restored[i][k] = old_index[faces[i][k]];
+            }
+            same = same && canonical_faces(restored) == canonical_faces(original_faces);
+            std::cout << std::setw(12) << name << std::setw(12) << faces.size()
+                << std::fixed << std::setprecision(3) << std::setw(10) << before
+                << std::setw(10) << meshopt::acmr(faces, vertices.size())
+                << std::setprecision(2) << std::setw(10) << ms
+                << std::setw(10) << (same ? "yes" : "NO") << std::defaultfloat << std::endl;
+        };
+
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        sphere::create_sphere(1.0, 10, 10, vertices, faces);
+        report("light", vertices, faces);
+        meshio::obj_mesh boat;
+        if (meshio::load_obj("boat.obj", boat)) {
+            report("boat", boat.vertices, boat.faces);
+        }
+        Menger menger;
+        for (int level = 2; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            const char* variants[] = {"c", "cw", "cwm"};
+            for (const char* variant : variants) {
+                menger.set_cull_hidden(true);
+                menger.set_weld_vertices(std::strchr(variant, 'w') != nullptr);
+                menger.set_merge_faces(std::strchr(variant, 'm') != nullptr);
+                menger.generate_geometry(vertices, faces);
+                report("menger " + std::to_string(level) + variant, vertices, faces);
+            }
+        }
+    }
+
+    // Cluster culling from a few camera positions, with the same projection
+    // as the window. "missed" counts front facing triangles with a corner in
+    // the frustum whose cluster was culled, and must stay 0.
+    void menger_clusters(void) {
+        std::cout << "menger clusters (culled, welded, cache optimized; % of triangles drawn)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(10) << "clusters" << std::setw(10) << "tris/cl"
+            << std::setw(10) << "build ms" << std::setw(8) << "view" << std::setw(10) << "frustum"
+            << std::setw(10) << "+cones" << std::setw(10) << "cull ms" << std::setw(8) << "missed" << std::endl;
+        struct view {
+            const char* name;
+            glm::vec3 eye, centre;
+        };
+        const view views[] = {
+            {"front", glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f)},
+            {"corner", glm::vec3(1.5f, 1.5f, 1.5f), glm::vec3(0.0f)},
+            {"close", glm::vec3(0.2f, 0.1f, 0.9f), glm::vec3(0.2f, 0.1f, 0.0f)},
+        };
+        const glm::mat4 projection = glm::perspectiveFov(glm::radians(45.0f), 800.0f, 600.0f, 0.0001f, 1000.0f);
+
+        Menger menger;
+        menger.set_cull_hidden(true);
+        menger.set_weld_vertices(true);
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        std::vector<meshlet::cluster> clusters;
+        std::vector<glm::uvec2> ranges;
+        for (int level = 2; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            menger.generate_geometry(vertices, faces);
+            std::vector<glm::vec4> optimized_vertices = vertices;
+            std::vector<glm::uvec3> optimized_faces = faces;
+            meshopt::optimize(optimized_vertices, optimized_faces);
+            const float acmr = meshopt::acmr(optimized_faces, vertices.size());
+            const std::vector<size_t> groups = meshlet::sort_faces(vertices, faces);
+            meshopt::optimize(vertices, faces, &groups);
+            const float sorted_acmr = meshopt::acmr(faces, vertices.size());
+            double build = time_ms(3, [&]() {
+                clusters = meshlet::build(vertices.data(), vertices.size(), faces.data(), faces.size());
+            });
+            for (const auto& v : views) {
+                const meshlet::frustum frustum = meshlet::extract_frustum(projection * glm::lookAt(v.eye, v.centre, glm::vec3(0.0f, 1.0f, 0.0f)));
+                const size_t in_frustum = meshlet::cull(clusters, frustum, v.eye, false, ranges);
+                size_t kept = 0;
+                double cull = time_ms(3, [&]() { kept = meshlet::cull(clusters, frustum, v.eye, true, ranges); });
+
+                size_t missed = 0;
+                for (const auto& c : clusters) {
+                    if (meshlet::visible(c, frustum, v.eye, true)) continue;
+                    for (size_t t = c.first_face; t < c.first_face + c.face_count; ++t) {
+                        const glm::vec3 p0(vertices[faces[t][0]]), p1(vertices[faces[t][1]]), p2(vertices[faces[t][2]]);
+                        if (glm::dot(glm::cross(p1 - p0, p2 - p0), v.eye - p0) <= 0.0f) continue;
+                        bool inside = false;
+                        for (int k = 0; k < 3 && !inside; ++k) {
+                            const glm::vec4 p = vertices[faces[t][k]];
+                            inside = true;
+                            for (const auto& plane : frustum.planes) {
+                                inside = inside && glm::dot(plane, p) >= 0.0f;
+                            }
+                        }
+                        missed += inside;
+                    }
+                }
+                std::cout << std::setw(6) << level << std::setw(10) << clusters.size()
+                    << std::fixed << std::setprecision(1) << std::setw(10) << double(faces.size()) / clusters.size()
+                    << std::setprecision(2) << std::setw(10) << build << std::setw(8) << v.name
+                    << std::setprecision(1) << std::setw(9) << 100.0 * in_frustum / faces.size() << "%"
+                    << std::setw(9) << 100.0 * kept / faces.size() << "%"
+                    << std::setprecision(3) << std::setw(10) << cull << std::setw(8) << missed
+                    << std::defaultfloat << std::endl;
+            }
+            std::cout << std::setw(6) << level << "  ACMR " << acmr << " whole mesh, " << sorted_acmr << " by normal group" << std::endl;
+        }
+    }
+
+    // GPU bytes of the float and compact (menger -c) layouts. Errors are
+    // the largest position error as a fraction of the bounds, and the
+    // largest normal error in degrees. Index batches, and the vertices
+    // they repeat (+), are counted as main uploads them, cut at cluster
+    // starts for the Menger meshes.
+    void vertex_formats(void) {
+        std::cout << "vertex formats (GPU bytes)" << std::endl;
+        std::cout << std::setw(12) << "mesh" << std::setw(10) << "vertices" << std::setw(8) << "" << std::setw(12) << "float"
+            << std::setw(12) << "compact" << std::setw(8) << "ratio" << std::setw(10) << "index"
+            << std::setw(12) << "pos err" << std::setw(10) << "norm err" << std::endl;
+        auto report = [](const std::string& name, const std::vector<glm::vec4>& vertices,
+                const std::vector<glm::uvec3>& faces, const std::vector<size_t>& cuts,
+                const std::vector<glm::vec4>* normals, const meshpack::bounds& bounds) {
+            std::vector<glm::i16vec4> positions;
+            meshpack::quantize_positions(vertices.data(), vertices.size(), bounds, positions);
+            float pos_err = 0.0f;
+            for (size_t i = 0; i < vertices.size(); ++i) {
+                const glm::vec3 d = glm::vec3(meshpack::dequantize_position(positions[i], bounds) - vertices[i]);
+                pos_err = std::max(pos_err, glm::length(d / bounds.extent) * 0.5f);
+            }
+            std::vector<glm::u16vec3> narrow_faces;
+            std::vector<meshpack::batch> batches;
+            std::vector<unsigned int> source;
+            const bool narrow = meshpack::narrow_faces(faces.data(), faces.size(), vertices.size(), cuts,
+                narrow_faces, batches, source);
+            const size_t compact_vertices = source.empty() ? vertices.size() : source.size();
+            size_t full = vertices.size() * sizeof(glm::vec4) + faces.size() * sizeof(glm::uvec3);
+            size_t compact = compact_vertices * sizeof(glm::i16vec4) + faces.size() * (narrow ? sizeof(glm::u16vec3) : sizeof(glm::uvec3));
+            float norm_err = 0.0f;
+            if (normals) {
+                full += normals->size() * sizeof(glm::vec4);
+                compact += normals->size() * sizeof(glm::i16vec2);
+                for (const auto& n : *normals) {
+                    const glm::vec3 unit = glm::normalize(glm::vec3(n));
+                    const float c = glm::dot(unit, meshpack::decode_normal(meshpack::encode_normal(unit)));
+                    norm_err = std::max(norm_err, std::acos(std::min(1.0f, c)) * 180.0f / float(M_PI));
+                }
+            }
+            const std::string repeated = compact_vertices > vertices.size()
+                ? "+" + std::to_string(compact_vertices - vertices.size()) : "";
+            std::cout << std::setw(12) << name << std::setw(10) << vertices.size() << std::setw(8) << repeated << std::setw(12) << full
+                << std::setw(12) << compact << std::fixed << std::setprecision(2) << std::setw(8) << double(full) / compact
+                << std::setw(10) << (narrow ? "16x" + std::to_string(batches.size()) : "32") << std::scientific << std::setprecision(1)
+                << std::setw(12) << pos_err;
+            if (normals) {
+                std::cout << std::fixed << std::setprecision(3) << std::setw(10) << norm_err;
+            } else {
+                std::cout << std::setw(10) << "-";
+            }
+            std::cout << std::defaultfloat << std::endl;
+        };
+
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::uvec3> faces;
+        sphere::create_sphere(1.0, 10, 10, vertices, faces);
+        report("light", vertices, faces, {}, nullptr, meshpack::mesh_bounds(vertices.data(), vertices.size()));
+        meshio::obj_mesh boat;
+        if (meshio::load_obj("boat.obj", boat)) {
+            report("boat", boat.vertices, boat.faces, {}, &boat.normals,
+                meshpack::mesh_bounds(boat.vertices.data(), boat.vertices.size()));
+        }
+        // The Menger meshes are quantized against the whole sponge and
+        // clustered, as in main
+        const meshpack::bounds sponge = {glm::vec3(0.0f), glm::vec3(0.5f)};
+        Menger menger;
+        menger.set_cull_hidden(true);
+        for (int level = 2; level <= 4; ++level) {
+            menger.set_nesting_level(level);
+            for (int weld = 0; weld <= 1; ++weld) {
+                menger.set_weld_vertices(weld);
+                menger.generate_geometry(vertices, faces);
+                const std::vector<size_t> groups = meshlet::sort_faces(vertices, faces);
+                meshopt::optimize(vertices, faces, &groups);
+                std::vector<size_t> cuts;
+                for (const auto& c : meshlet::build(vertices.data(), vertices.size(), faces.data(), faces.size())) {
+                    cuts.push_back(c.first_face);
+                }
+                report("menger " + std::to_string(level) + (weld ? "cw" : "c"), vertices, faces, cuts, nullptr, sponge);
+            }
+        }
+        // a level 5 chunk: indices are 16-bit in both layouts
+        std::vector<glm::u16vec3> chunk_faces;
+        menger.set_nesting_level(5);
+        menger.set_weld_vertices(false);
+        menger.generate_chunk(0, vertices, chunk_faces);
+        const size_t full = vertices.size() * sizeof(glm::vec4) + chunk_faces.size() * sizeof(glm::u16vec3);
+        const size_t compact = vertices.size() * sizeof(glm::i16vec4) + chunk_faces.size() * sizeof(glm::u16vec3);
+        std::cout << std::setw(12) << "chunk 5c" << std::setw(10) << vertices.size() << std::setw(8) << "" << std::setw(12) << full
+            << std::setw(12) << compact << std::fixed << std::setprecision(2) << std::setw(8) << double(full) / compact
+            << std::setw(10) << "16x1" << std::defaultfloat << std::endl;
+    }
+
+    // Every fastmath.h function against libm (in double) over its documented
+    // range, on plain floats and SSE2. The error is relative to the larger of
+    // the exact value and `floor`, so absolute when floor is 1 and the values
+    // are below 1.
+    template <typename Ref, typename Fast>
+    void fast_math_case(const char* name, const char* range, double floor, const std::vector<float>& xs,
+            const std::vector<float>& ys, Ref ref, Fast fast) {
+        const size_t n = xs.size();
+        std::vector<float> out(n);
+        auto run = [&](auto v) {
+            typedef decltype(v) V;
+            for (size_t i = 0; i < n; i += V::width) {
+                V::store(&out[i], fast(v, V::load(&xs[i]), V::load(&ys[i])));
+            }
+        };
+        run(fastmath::scalar());
+        double err = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const double r = ref(double(xs[i]), double(ys[i]));
+            const double d = std::abs(out[i] - r);
+            err = std::max(err, d / std::max(std::abs(r), floor));
+        }
+        const double libm_ms = time_ms(5, [&]() {
+            for (size_t i = 0; i < n; ++i) out[i] = float(ref(xs[i], ys[i]));
+        });
+        const double scalar_ms = time_ms(5, [&]() { run(fastmath::scalar()); });
+        std::cout << std::setw(8) << name << std::setw(22) << range << std::scientific << std::setprecision(1)
+            << std::setw(10) << err << std::setw(6) << std::defaultfloat << floor << std::fixed << std::setprecision(2)
+            << std::setw(10) << libm_ms * 1e6 / n << std::setw(10) << scalar_ms * 1e6 / n;
+#if defined(__SSE2__)
+        const double sse2_ms = time_ms(5, [&]() { run(fastmath::sse2()); });
+        std::cout << std::setw(10) << sse2_ms * 1e6 / n;
+#else
+        std::cout << std::setw(10) << "-";
+#endif
+        std::cout << std::defaultfloat << std::endl;
+    }
+
+    void fast_math(void) {
+        std::cout << "fast math (vs libm, ns/value)" << std::endl;
+        std::cout << std::setw(8) << "fn" << std::setw(22) << "range" << std::setw(10) << "max err" << std::setw(6) << "floor"
+            << std::setw(10) << "libm" << std::setw(10) << "scalar" << std::setw(10) << "sse2" << std::endl;
+        const size_t n = 1 << 20;
+        std::vector<float> xs(n), ys(n);
+        auto sweep = [&](double lo, double hi) {
+            for (size_t i = 0; i < n; ++i) xs[i] = float(lo + (hi - lo) * i / (n - 1));
+        };
+        srand(378);
+        for (auto& y : ys) y = 8.0f * rand() / RAND_MAX;
+
+        sweep(-1e4, 1e4);
+        fast_math_case("sin", "|x| <= 1e4", 1.0, xs, ys,
+            [](double x, double) { return std::sin(x); },
+            [](auto v, auto x, auto) { typedef decltype(v) V; typename V::reg s, c; fastmath::sincos<V>(x, s, c); return s; });
+        fast_math_case("cos", "|x| <= 1e4", 1.0, xs, ys,
+            [](double x, double) { return std::cos(x); },
+            [](auto v, auto x, auto) { typedef decltype(v) V; typename V::reg s, c; fastmath::sincos<V>(x, s, c); return c; });
+        sweep(-87, 88);
+        fast_math_case("exp", "-87 <= x <= 88", 1e-30, xs, ys,
+            [](double x, double) { return std::exp(x); },
+            [](auto v, auto x, auto) { return fastmath::exp<decltype(v)>(x); });
+        sweep(-126, 127);
+        fast_math_case("exp2", "-126 <= x <= 127", 1e-30, xs, ys,
+            [](double x, double) { return std::exp2(x); },
+            [](auto v, auto x, auto) { return fastmath::exp2<decltype(v)>(x); });
+        for (size_t i = 0; i < n; ++i) xs[i] = float(std::pow(10.0, -30.0 + 60.0 * i / (n - 1)));
+        fast_math_case("log2", "1e-30 <= x <= 1e30", 1.0, xs, ys,
+            [](double x, double) { return std::log2(x); },
+            [](auto v, auto x, auto) { return fastmath::log2<decltype(v)>(x); });
+        sweep(0, 1);
+        fast_math_case("pow", "x <= 1, y <= 8", 1e-30, xs, ys,
+            [](double x, double y) { return std::pow(x, y); },
+            [](auto v, auto x, auto y) { return fastmath::pow<decltype(v)>(x, y); });
+    }
+
+    // Heights and normals over a grid of the ocean: simulate_offset and
+    // simulate_normal per point, against simulate_surface and simulate_batch
+    // on each instruction set
+    // A minute of frames at 60 fps, with every wave living 2 to 7 seconds
+    void wave_pool(void) {
+        std::cout << "wave pool (3600 frames of elapse_time)" << std::endl;
+        std::cout << std::setw(8) << "waves" << std::setw(12) << "us/frame" << std::setw(12) << "respawns"
+            << std::setw(12) << "same seed" << std::endl;
+        const double frame_ns = 1e9 / 60;
+        for (unsigned int storminess : {6, 61, 253}) {
+            fluid::ocean_surf_params ocean, twin;
+            ocean.storminess = twin.storminess = storminess;
+            const double ms = time_ms(1, [&]() {
+                for (int frame = 0; frame < 3600; ++frame) ocean.elapse_time(frame_ns);
+            });
+            // New waves start at time 0, the rest have aged at least a frame
+            size_t respawns = 0;
+            for (int frame = 0; frame < 3600; ++frame) {
+                twin.elapse_time(frame_ns);
+                respawns += std::count(twin.wpars.time(), twin.wpars.time() + twin.wpars.size(), 0.0f);
+            }
+            bool same = ocean.wpars.size() == twin.wpars.size();
+            for (size_t i = 0; same && i < ocean.wpars.size(); ++i) {
+                same = ocean.wpars.time()[i] == twin.wpars.time()[i] && ocean.wpars.l()[i] == twin.wpars.l()[i];
+            }
+            std::cout << std::setw(8) << ocean.wpars.size() << std::fixed << std::setprecision(2)
+                << std::setw(12) << ms * 1e3 / 3600 << std::setw(12) << respawns
+                << std::setw(12) << (same ? "yes" : "no") << std::defaultfloat << std::endl;
+        }
+    }
+
+    void wave_batch(void) {
+        std::cout << "wave batch (128x128 points, f = non-integer steepness)" << std::endl;
+        std::cout << std::setw(8) << "waves" << std::setw(8) << "path" << std::setw(12) << "ns/point"
+            << std::setw(10) << "speedup" << std::setw(12) << "height err" << std::setw(12) << "normal err" << std::endl;
+        const int kSide = 128;
+        std::vector<float> x, z;
+        for (int i = 0; i < kSide; ++i) {
+            for (int j = 0; j < kSide; ++j) {
+                x.push_back(-20.0f + 40.0f * j / kSide);
+                z.push_back(-20.0f + 40.0f * i / kSide);
+            }
+        }
+        const size_t count = x.size();
+        std::vector<float> heights(count), ref_heights(count);
+        std::vector<glm::vec4> normals(count), ref_normals(count);
+        srand(378);
+        const double t = 123456.0;
+        struct variant { int storminess; bool fractional; };
+        for (const variant& v : {variant{0, false}, variant{4, false}, variant{12, false}, variant{4, true}}) {
+            fluid::ocean_surf_params ocean;
+            ocean.storminess = v.storminess;
+            for (int i = 0; i < 3 + v.storminess; ++i) {
+                fluid::wave_params wave = fluid::generate_wave(v.storminess, i + 1);
+                wave.time = wave.life / 3;
+                if (v.fractional) wave.k += 0.4f + 0.1f * i;
+                ocean.wpars.spawn(wave);
+            }
+            ocean.swells = {{glm::vec2(0.01f, 0.0f), glm::vec2(-2.0f, 1.0f), 1.5f, 3.0f, t - 50.0}};
+
+            double scalar_ms = time_ms(3, [&]() {
+                for (size_t i = 0; i < count; ++i) {
+                    glm::vec2 pos(x[i], z[i]);
+                    ref_heights[i] = fluid::simulate_offset(t, pos, ocean)[1];
+                    ref_normals[i] = fluid::simulate_normal(t, pos, ocean);
+                }
+            });
+            std::cout << std::setw(8) << std::to_string(ocean.wpars.size()) + (v.fractional ? "f" : "")
+                << std::setw(8) << "point" << std::fixed
+                << std::setprecision(1) << std::setw(12) << scalar_ms * 1e6 / count << std::setw(10) << 1.0
+                << std::setw(12) << "-" << std::setw(12) << "-" << std::defaultfloat << std::endl;
+
+            // Relative to the largest value, as the heights span zero
+            auto report = [&](const char* name, double ms) {
+                float max_height = 0.0f, max_normal = 0.0f, height_err = 0.0f, normal_err = 0.0f;
+                for (size_t i = 0; i < count; ++i) {
+                    max_height = std::max(max_height, std::abs(ref_heights[i]));
+                    max_normal = std::max(max_normal, glm::length(ref_normals[i]));
+                    height_err = std::max(height_err, std::abs(heights[i] - ref_heights[i]));
+                    normal_err = std::max(normal_err, glm::length(normals[i] - ref_normals[i]));
+                }
+                std::cout << std::setw(8) << "" << std::setw(8) << name << std::fixed
+                    << std::setprecision(1) << std::setw(12) << ms * 1e6 / count << std::setw(10) << scalar_ms / ms
+                    << std::scientific << std::setprecision(1) << std::setw(12) << height_err / max_height
+                    << std::setw(12) << normal_err / max_normal << std::defaultfloat << std::endl;
+            };
+
+            report("fused", time_ms(3, [&]() {
+                for (size_t i = 0; i < count; ++i) {
+                    const fluid::surface_sample surface = fluid::simulate_surface(t, glm::vec2(x[i], z[i]), ocean);
+                    heights[i] = surface.offset[1];
+                    normals[i] = surface.normal;
+                }
+            }));
+
+            const fluid::wave_bank bank = fluid::make_wave_bank(t, ocean);
+            const fluid::batch_isa best = fluid::best_batch_isa();
+            report("libm", time_ms(5, [&]() {
+                fluid::simulate_batch(bank, x.data(), z.data(), count, heights.data(), normals.data(),
+                    fluid::batch_isa::scalar, fluid::batch_math::libm);
+            }));
+            const char* names[] = {"scalar", "sse2", "avx2"};
+            for (auto isa : {fluid::batch_isa::scalar, fluid::batch_isa::sse2, fluid::batch_isa::avx2}) {
+                if (isa > best) continue;
+                report(names[int(isa)], time_ms(5, [&]() {
+                    fluid::simulate_batch(bank, x.data(), z.data(), count, heights.data(), normals.data(), isa);
+                }));
+            }
+        }
+    }
+
+    // Filling an ocean heightfield and querying it, against evaluating the
+    // waves at each query. The error is the largest over random points, next
+    // to the bound the grid reports.
+    void ocean_heightfield(void) {
+        std::cout << "ocean heightfield (40x40 ocean, 7 waves, 10000 queries)" << std::endl;
+        std::cout << std::setw(8) << "cells" << std::setw(10) << "fill ms" << std::setw(12) << "query ns"
+            << std::setw(12) << "direct ns" << std::setw(12) << "height err" << std::setw(10) << "bound"
+            << std::setw(12) << "normal deg" << std::endl;
+        srand(378);
+        const double t = 123456.0;
+        fluid::ocean_surf_params ocean;
+        ocean.storminess = 4;
+        for (int i = 0; i < 7; ++i) {
+            fluid::wave_params wave = fluid::generate_wave(4, i + 1);
+            wave.time = wave.life / 3;
+            ocean.wpars.spawn(wave);
+        }
+        ocean.swells = {{glm::vec2(0.01f, 0.0f), glm::vec2(-2.0f, 1.0f), 1.5f, 3.0f, t - 50.0}};
+
+        const size_t kQueries = 10000;
+        std::vector<glm::vec2> points;
+        for (size_t i = 0; i < kQueries; ++i) {
+            points.push_back(glm::vec2(40.0f * rand() / RAND_MAX - 20.0f, 40.0f * rand() / RAND_MAX - 20.0f));
+        }
+        std::vector<fluid::surface_sample> direct(kQueries);
+        const double direct_ms = time_ms(3, [&]() {
+            for (size_t i = 0; i < kQueries; ++i) direct[i] = fluid::simulate_surface(t, points[i], ocean);
+        });
+
+        for (int cells : {32, 64, 128, 256, 512}) {
+            fluid::heightfield grid(glm::vec2(-20.0f), glm::vec2(20.0f), cells,
+                fluid::heightfield::update_policy::every_frame);
+            const double fill_ms = time_ms(3, [&]() { grid.update(t, ocean); });
+            std::vector<fluid::surface_sample> samples(kQueries);
+            const double query_ms = time_ms(3, [&]() {
+                for (size_t i = 0; i < kQueries; ++i) samples[i] = grid.sample(points[i]);
+            });
+            float height_err = 0.0f, normal_err = 0.0f;
+            for (size_t i = 0; i < kQueries; ++i) {
+                height_err = std::max(height_err, std::abs(samples[i].offset[1] - direct[i].offset[1]));
+                // atan2 rather than acos, which loses small angles in float
+                const glm::vec3 a(samples[i].normal), b(direct[i].normal);
+                const float angle = std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b));
+                normal_err = std::max(normal_err, angle * 180.0f / float(M_PI));
+            }
+            std::cout << std::setw(8) << cells << std::fixed << std::setprecision(2) << std::setw(10) << fill_ms
+                << std::setprecision(1) << std::setw(12) << query_ms * 1e6 / kQueries
+                << std::setw(12) << direct_ms * 1e6 / kQueries << std::scientific << std::setprecision(1)
+                << std::setw(12) << height_err << std::setw(10) << grid.height_error() << std::fixed
+                << std::setprecision(3) << std::setw(12) << normal_err << std::defaultfloat << std::endl;
+        }
+    }
+
+    // Swells of sigma 0.5 to 2 scattered over the 40x40 ocean, against
+    // evaluating every swell at every point
+    void ocean_swells(void) {
+        std::cout << "ocean swells (40x40 ocean, 10000 queries)" << std::endl;
+        std::cout << std::setw(8) << "swells" << std::setw(12) << "culled ns" << std::setw(12) << "full ns"
+            << std::setw(10) << "reach" << std::setw(12) << "batch ns" << std::setw(12) << "max diff"
+            << std::setw(10) << "bound" << std::endl;
+        std::mt19937 rng(378);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<float> xs(10000), zs(10000);
+        for (size_t i = 0; i < xs.size(); ++i) {
+            xs[i] = 40.0f * unit(rng) - 20.0f;
+            zs[i] = 40.0f * unit(rng) - 20.0f;
+        }
+        for (int n : {1, 8, 32}) {
+            fluid::ocean_surf_params ocean;
+            for (int i = 0; i < n; ++i) {
+                ocean.swells.push_back({glm::vec2(unit(rng), unit(rng)) * 0.01f,
+                    glm::vec2(40.0f * unit(rng) - 20.0f, 40.0f * unit(rng) - 20.0f), 5.0f * unit(rng),
+                    0.5f + 1.5f * unit(rng), 0.0});
+            }
+            const fluid::swell_block block = fluid::make_swell_block(50.0, ocean);
+            std::vector<float> culled(xs.size()), full(xs.size());
+            const double culled_ms = time_ms(3, [&]() {
+                for (size_t i = 0; i < xs.size(); ++i) {
+                    fluid::surface_sample s = {glm::vec4(0.0f), glm::vec4(0.0f)};
+                    fluid::swell_surface(block, glm::vec2(xs[i], zs[i]), s);
+                    culled[i] = s.offset[1];
+                }
+            });
+            const double full_ms = time_ms(3, [&]() {
+                for (size_t i = 0; i < xs.size(); ++i) {
+                    float h = 0.0f;
+                    for (int w = 0; w < block.count.x; ++w) {
+                        const glm::vec4& swell = block.swells[w];
+                        const float dx = swell.x - xs[i], dz = swell.y - zs[i];
+                        h += swell.z * std::exp(-(dx * dx + dz * dz) / (2 * swell.w * swell.w));
+                    }
+                    full[i] = h;
+                }
+            });
+            const fluid::wave_bank bank = fluid::make_wave_bank(50.0, ocean);
+            std::vector<float> heights(xs.size());
+            const double batch_ms = time_ms(3, [&]() {
+                fluid::simulate_batch(bank, xs.data(), zs.data(), xs.size(), heights.data(), nullptr);
+            });
+            size_t reach = 0;
+            float diff = 0.0f, bound = 0.0f;
+            for (size_t i = 0; i < xs.size(); ++i) {
+                for (int w = 0; w < block.count.x; ++w) {
+                    const glm::vec2 d = glm::vec2(block.swells[w]) - glm::vec2(xs[i], zs[i]);
+                    reach += glm::dot(d, d) < 16 * block.swells[w].w * block.swells[w].w;
+                }
+                diff = std::max(diff, std::max(std::abs(culled[i] - full[i]), std::abs(heights[i] - full[i])));
+            }
+            for (int w = 0; w < block.count.x; ++w) bound += block.swells[w].z * std::exp(-8.0f);
+            std::cout << std::setw(8) << n << std::fixed << std::setprecision(1)
+                << std::setw(12) << culled_ms * 1e6 / xs.size() << std::setw(12) << full_ms * 1e6 / xs.size()
+                << std::setprecision(2) << std::setw(10) << double(reach) / xs.size() << std::setprecision(1)
+                << std::setw(12) << batch_ms * 1e6 / xs.size() << std::scientific
+                << std::setw(12) << diff << std::setw(10) << bound << std::defaultfloat << std::endl;
+        }
+    }
+
+    // make_wave_bank with a sample spacing against the full bank: waves kept,
+    // batch cost per point, the mean height change (0 when waves fade toward
+    // their mean), and the RMS height and slope of the ripple faded out,
+    // which a grid that coarse could only have drawn as alias
+    void wave_lod(void) {
+        std::cout << "wave lod (20 waves, storminess 20, 10000 points)" << std::endl;
+        std::cout << std::setw(8) << "spacing" << std::setw(8) << "waves" << std::setw(12) << "batch ns"
+            << std::setw(10) << "speedup" << std::setw(12) << "mean diff" << std::setw(12) << "rms height"
+            << std::setw(12) << "rms slope" << std::endl;
+        std::mt19937 rng(378);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        fluid::ocean_surf_params ocean;
+        for (int i = 0; i < 20; ++i) {
+            fluid::wave_params wave = fluid::generate_wave(20, i + 1, rng);
+            wave.time = wave.life / 3;
+            ocean.wpars.spawn(wave);
+        }
+        const size_t count = 10000;
+        std::vector<float> xs(count), zs(count);
+        for (size_t i = 0; i < count; ++i) {
+            xs[i] = 40.0f * unit(rng) - 20.0f;
+            zs[i] = 40.0f * unit(rng) - 20.0f;
+        }
+
+        std::vector<float> ref_heights(count), heights(count);
+        std::vector<glm::vec4> ref_normals(count), normals(count);
+        double full_ms = 0;
+        for (float spacing : {0.0f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f}) {
+            const fluid::wave_bank bank = fluid::make_wave_bank(50.0, ocean, spacing);
+            const double ms = time_ms(5, [&]() {
+                fluid::simulate_batch(bank, xs.data(), zs.data(), count, heights.data(), normals.data());
+            });
+            if (spacing == 0) {
+                full_ms = ms;
+                ref_heights = heights;
+                ref_normals = normals;
+            }
+            double height_sum = 0, height_sq = 0, slope_sq = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const double dh = heights[i] - ref_heights[i];
+                height_sum += dh;
+                const glm::vec2 ds = glm::vec2(normals[i].x, normals[i].z)
+                    - glm::vec2(ref_normals[i].x, ref_normals[i].z);
+                height_sq += dh * dh;
+                slope_sq += glm::dot(ds, ds);
+            }
+            std::cout << std::setw(8) << spacing << std::setw(8) << bank.size() << std::fixed
+                << std::setprecision(1) << std::setw(12) << ms * 1e6 / count << std::setw(10) << full_ms / ms
+                << std::setprecision(3) << std::setw(12) << height_sum / count << std::setw(12) << std::sqrt(height_sq / count)
+                << std::setw(12) << std::sqrt(slope_sq / count) << std::defaultfloat << std::endl;
+        }
+    }
+
+    // The FFT against summing every wave directly, at grid samples where the
+    // two should agree to float rounding
+    void spectral_ocean(void) {
+#ifdef _OPENMP
+        std::cout << "spectral ocean (40x40 tile, 10 m/s wind, 2 m waves, " << omp_get_max_threads()
+            << " threads)" << std::endl;
+#else
+        std::cout << "spectral ocean (40x40 tile, 10 m/s wind, 2 m waves, built without OpenMP)" << std::endl;
+#endif
+        std::cout << std::setw(10) << "spectrum" << std::setw(6) << "N" << std::setw(10) << "waves"
+            << std::setw(10) << "build ms" << std::setw(11) << "update ms" << std::setw(10) << "Hs"
+            << std::setw(12) << "height err" << std::setw(12) << "slope err" << std::endl;
+        const double t = 123.456;
+        for (fluid::spectrum_type type : {fluid::spectrum_type::phillips, fluid::spectrum_type::jonswap}) {
+            for (int n : {128, 256, 512}) {
+                fluid::spectral_params params;
+                params.spectrum = type;
+                params.resolution = n;
+                std::unique_ptr<fluid::spectral_ocean> ocean;
+                const double build_ms = time_ms(1, [&]() { ocean.reset(new fluid::spectral_ocean(params)); });
+                const double update_ms = time_ms(5, [&]() { ocean->update(t); });
+                // Hs = 4 sigma, with the variance averaged over the loop
+                const int snapshots = 16;
+                double variance = 0.0;
+                for (int i = 0; i < snapshots; ++i) {
+                    ocean->update(double(params.loop_period) * i / snapshots);
+                    for (const glm::vec4& s : ocean->tile()) variance += double(s.y) * s.y;
+                }
+                const double hs = 4.0 * std::sqrt(variance / (snapshots * ocean->tile().size()));
+                ocean->update(t);
+                float height_err = 0.0f, slope_err = 0.0f;
+                const float cell = params.tile_size / n;
+                for (int i = 0; i < 8; ++i) {
+                    const int gx = (i * 37) % n, gz = (i * 91 + 5) % n;
+                    const glm::vec4 s = ocean->tile()[size_t(gz) * n + gx];
+                    const fluid::surface_sample direct = ocean->evaluate(glm::vec2(gx * cell, gz * cell));
+                    height_err = std::max(height_err, std::abs(s.y - direct.offset[1]));
+                    slope_err = std::max(slope_err, std::max(std::abs(s.x - direct.normal[0]),
+                        std::abs(s.z - direct.normal[2])));
+                }
+                std::cout << std::setw(10) << (type == fluid::spectrum_type::phillips ? "phillips" : "jonswap")
+                    << std::setw(6) << n << std::setw(10) << ocean->wave_count() << std::fixed
+                    << std::setprecision(2) << std::setw(10) << build_ms << std::setw(11) << update_ms
+                    << std::setw(10) << hs << std::scientific << std::setprecision(1) << std::setw(12)
+                    << height_err << std::setw(12) << slope_err << std::defaultfloat << std::endl;
+            }
+        }
+    }
+
+    // The first rows crowd more and more packets onto the 40x40 ocean; the
+    // last two grow the ocean with them, at the density of 1000 on 40x40
+    void wave_packets(void) {
+        std::cout << "wave packets (radius 2, 2x2 cells, 10000 queries, brute force on 1000)" << std::endl;
+        std::cout << std::setw(8) << "packets" << std::setw(8) << "side" << std::setw(12) << "update ms"
+            << std::setw(12) << "query ns" << std::setw(12) << "per cell" << std::setw(12) << "brute ns"
+            << std::setw(12) << "max diff" << std::endl;
+        struct variant { size_t packets; float side; };
+        for (const variant& v : {variant{100, 40.0f}, variant{1000, 40.0f}, variant{10000, 40.0f},
+                variant{10000, 40.0f * std::sqrt(10.0f)}, variant{100000, 400.0f}}) {
+            std::mt19937 rng(378);
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+            const glm::vec2 lo(-v.side / 2), hi(v.side / 2);
+            std::vector<fluid::wave_packet> packets(v.packets);
+            for (fluid::wave_packet& packet : packets) {
+                const float angle = 2 * float(M_PI) * unit(rng);
+                packet.start = -6.0 * unit(rng);
+                packet.center = lo + (hi - lo) * glm::vec2(unit(rng), unit(rng));
+                packet.dir = glm::vec2(std::cos(angle), std::sin(angle));
+                packet.wavelength = 0.5f + unit(rng);
+                packet.life = 10.0f;
+            }
+            fluid::packet_field field(lo, hi, 2.0f);
+            const double update_ms = time_ms(3, [&]() { field.update(0.0, packets); });
+
+            std::vector<glm::vec2> points(10000);
+            for (glm::vec2& point : points) point = lo + (hi - lo) * glm::vec2(unit(rng), unit(rng));
+            std::vector<fluid::surface_sample> samples(points.size());
+            const double query_ms = time_ms(3, [&]() {
+                for (size_t i = 0; i < points.size(); ++i) samples[i] = field.sample(points[i]);
+            });
+            size_t load = 0;
+            for (const glm::vec2& point : points) load += field.cell_load(point);
+            const size_t kBrute = 1000;
+            std::vector<fluid::surface_sample> brute(kBrute);
+            const double brute_ms = time_ms(1, [&]() {
+                for (size_t i = 0; i < kBrute; ++i) brute[i] = field.sample_all(points[i]);
+            });
+            float diff = 0.0f;
+            for (size_t i = 0; i < kBrute; ++i) {
+                diff = std::max(diff, std::abs(samples[i].offset[1] - brute[i].offset[1]));
+                diff = std::max(diff, glm::length(samples[i].normal - brute[i].normal));
+            }
+            std::cout << std::setw(8) << v.packets << std::setw(8) << int(v.side) << std::fixed
+                << std::setprecision(2) << std::setw(12) << update_ms << std::setprecision(1)
+                << std::setw(12) << query_ms * 1e6 / points.size() << std::setw(12) << double(load) / points.size()
+                << std::setw(12) << brute_ms * 1e6 / kBrute << std::scientific << std::setprecision(1)
+                << std::setw(12) << diff << std::defaultfloat << std::endl;
+        }
+    }
+
+    // Deep levels as full meshes, from a sample of chunks (too slow to build
+    // in full), against drawing them as instanced sponges with a level of
+    // detail per chunk: GPU bytes, and triangles drawn from the views of
+    // menger_clusters at the window's 800x600
+    void menger_chunks(void) {
+        std::cout << "menger chunks (culled, * = extrapolated from 64 chunks)" << std::endl;
+        std::cout << std::setw(6) << "level" << std::setw(10) << "chunks"
+            << std::setw(14) << "full tris" << std::setw(15) << "full bytes"
+            << std::setw(12) << "inst bytes" << std::setw(8) << "view" << std::setw(12) << "drawn tris"
+            << std::setw(10) << "lod ms" << std::endl;
+        struct view {
+            const char* name;
+            glm::vec3 eye, centre;
+        };
+        const view views[] = {
+            {"front", glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f)},
+            {"corner", glm::vec3(1.5f, 1.5f, 1.5f), glm::vec3(0.0f)},
+            {"close", glm::vec3(0.2f, 0.1f, 0.9f), glm::vec3(0.2f, 0.1f, 0.0f)},
+        };
+        const glm::mat4 projection = glm::perspectiveFov(glm::radians(45.0f), 800.0f, 600.0f, 0.0001f, 1000.0f);
+        const float lod_pixel = 2 * std::tan(glm::radians(45.0f) / 2) / 600.0f;
+
+        const size_t kSampleChunks = 64;
+        Menger menger;
+        menger.set_cull_hidden(true);
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::u16vec3> faces;
+        std::vector<glm::uvec3> lod_faces;
+        std::vector<size_t> lod_triangles;
+        size_t lod_bytes = 0;
+        for (int level = 0; level <= Menger::chunk_depth(); ++level) {
+            menger.set_nesting_level(level);
+            menger.generate_geometry(vertices, lod_faces);
+            lod_triangles.push_back(lod_faces.size());
+            lod_bytes += vertices.size() * sizeof(glm::vec4) + lod_faces.size() * sizeof(glm::uvec3);
+        }
+        std::vector<glm::u16vec4> cells;
+        for (int level = 5; level <= 7; ++level) {
+            menger.set_nesting_level(level);
+            const size_t chunks = menger.chunk_count();
+            const size_t step = std::max<size_t>(1, chunks / kSampleChunks);
+            size_t sampled = 0, triangles = 0, bytes = 0;
+            for (size_t chunk = 0; chunk < chunks; chunk += step, ++sampled) {
+                menger.generate_chunk(chunk, vertices, faces);
+                triangles += faces.size();
+                bytes += vertices.size() * sizeof(glm::vec4) + faces.size() * sizeof(glm::u16vec3);
+            }
+            const double scale = double(chunks) / sampled;
+            menger.generate_chunk_cells(cells);
+            const float chunk_size = menger.chunk_size();
+            const float radius = chunk_size * 0.8660254f;
+
+            for (const auto& v : views) {
+                const meshlet::frustum frustum = meshlet::extract_frustum(projection * glm::lookAt(v.eye, v.centre, glm::vec3(0.0f, 1.0f, 0.0f)));
+                size_t drawn = 0;
+                // as DrawMengerChunks in main.cc
+                const double ms = time_ms(3, [&]() {
+                    drawn = 0;
+                    for (const glm::u16vec4& cell : cells) {
+                        const glm::vec3 centre = (glm::vec3(cell) + 0.5f) * chunk_size - 0.5f;
+                        if (!meshlet::visible(frustum, centre, radius)) continue;
+                        const float distance = std::max(glm::length(centre - v.eye) - radius, 1e-4f);
+                        drawn += lod_triangles[Menger::chunk_lod(chunk_size / (distance * lod_pixel))];
+                    }
+                });
+                if (&v == views) {
+                    std::cout << std::setw(6) << level << std::setw(10) << chunks << std::fixed << std::setprecision(0)
+                        << std::setw(13) << triangles * scale << (step > 1 ? "*" : " ")
+                        << std::setw(14) << bytes * scale << (step > 1 ? "*" : " ")
+                        << std::setw(12) << lod_bytes + cells.size() * sizeof(glm::u16vec4);
+                } else {
+                    std::cout << std::setw(6 + 10 + 14 + 15 + 12) << "";
+                }
+                std::cout << std::setw(8) << v.name << std::setw(12) << drawn << std::fixed << std::setprecision(2)
+                    << std::setw(10) << ms << std::defaultfloat << std::endl;
+            }
+        }
+    }
+}
+
+void bench::run(void) {
+    menger_generation();
+    menger_culling();
+    menger_welding();
+    menger_parallel();
+    menger_instancing();
+    menger_merging();
+    mesh_cache();
+    obj_export();
+    export_formats();
+    obj_import();
+    mesh_optimization();
+    menger_clusters();
+    vertex_formats();
+    fast_math();
+    wave_pool();
+    wave_batch();
+    ocean_heightfield();
+    ocean_swells();
+    wave_lod();
+    spectral_ocean();
+    wave_packets();
+    menger_chunks();
+}
@@ -0,0 +1,9 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+// Offline micro-benchmarks, run with `menger -b`. Nothing here touches OpenGL.
+namespace bench {
+    void run(void);
+}
+
+#endif
@@ -1,34 +1,13 @@
 #include "fluid.h"
+#include "fluid_simd.h"
 
 #include <glm/gtc/constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <iostream>
 
+#include <cmath>
 #include <cstdlib>
 
-/* gaussian wave */
-float moving_gaussian_offset(double t, glm::vec2 pos, fluid::gaussian_params& gp) {
-    glm::vec2 n_c = gp.dir * float(t) + gp.center;
-    float dist = glm::distance(pos, n_c);
-    return gp.A * glm::exp(-(dist * dist) / (2 * gp.sigma * gp.sigma));
-}
-glm::vec3 moving_gaussian_normal(double t, glm::vec2 pos, fluid::gaussian_params& gp) {
-    glm::vec2 n_c = gp.dir * float(t) + gp.center;
-    float dist = glm::distance(pos, n_c);
-    float base = gp.A * glm::exp(-(dist * dist) / (2 * gp.sigma * gp.sigma)) / (gp.sigma * gp.sigma);
-    float dx = base * (n_c[0] - pos[0]);
-    float dy = base * (n_c[1] - pos[1]);
-    return glm::vec3(-dx, 1, dy);
-}
-
-/* gaussian tidal wave */
-glm::vec4 tidal_offset(double t,glm::vec2 pos, fluid::gaussian_params& gp) {
-    return glm::vec4(0.0f, moving_gaussian_offset(t, pos, gp), 0.0f, 0.0f);
-}
-glm::vec4 tidal_normal(double t, glm::vec2 pos, fluid::gaussian_params gp) {
-    return glm::vec4(moving_gaussian_normal(t, pos, gp), 0.0f);
-}
-
 /* regular small wave */
 float single_wave_offset(double t, glm::vec2 pos, fluid::wave_params& wpars) {
     float cal = wpars.time / wpars.life;
@@ -47,36 +26,92 @@ glm::vec4 single_wave_normal(double t, glm::vec2 pos, fluid::wave_params& wpars)
 }
 
 /* regular small waves */
-glm::vec4 wave_offset(double t, glm::vec2 pos, std::vector<fluid::wave_params>& wpars_vec) {
+glm::vec4 wave_offset(double t, glm::vec2 pos, const fluid::wave_pool& pool) {
     auto offset = glm::vec4();
-    for (auto& wave_params: wpars_vec) {
+    for (size_t i = 0; i < pool.size(); ++i) {
+        fluid::wave_params wave_params = pool[i];
         offset += glm::vec4(0.0f, single_wave_offset(t, pos, wave_params), 0.0f, 0.0f);
     }
     return offset;
 }
-glm::vec4 wave_normal(double t, glm::vec2 pos, std::vector<fluid::wave_params>& wpars_vec) {
+glm::vec4 wave_normal(double t, glm::vec2 pos, const fluid::wave_pool& pool) {
     auto norm = glm::vec4();
-    for (auto& wpars: wpars_vec) {
+    for (size_t i = 0; i < pool.size(); ++i) {
+        fluid::wave_params wpars = pool[i];
         norm += single_wave_normal(t, pos, wpars);
     }
     return norm;
 }
 
 glm::vec4 fluid::simulate_offset(double t, glm::vec2& pos, fluid::ocean_surf_params& ospars) {
-    auto offset = wave_offset(t, pos, ospars.wpars);
-    double tidal_time = t - ospars.gp.start;
-    if (tidal_time < 100) {
-        offset += tidal_offset(tidal_time, pos, ospars.gp);
-    }
-    return offset;
+    surface_sample swells = {glm::vec4(0.0f), glm::vec4(0.0f)};
+    swell_surface(make_swell_block(t, ospars), pos, swells);
+    return wave_offset(t, pos, ospars.wpars) + swells.offset;
 }
 glm::vec4 fluid::simulate_normal(double t, glm::vec2& pos, fluid::ocean_surf_params& ospars) {
-    auto normal = wave_normal(t, pos, ospars.wpars);
-    double tidal_time = t - ospars.gp.start;
-    if (tidal_time < 100) {
-        normal += tidal_normal(tidal_time, pos, ospars.gp);
+    surface_sample swells = {glm::vec4(0.0f), glm::vec4(0.0f)};
+    swell_surface(make_swell_block(t, ospars), pos, swells);
+    return wave_normal(t, pos, ospars.wpars) + swells.normal;
+}
+
+/* height and normal together */
+void single_wave_surface(double t, const glm::vec2& pos, const fluid::wave_params& wpars,
+        fluid::surface_sample& out) {
+    float cal = wpars.time / wpars.life;
+    double arg = glm::dot(wpars.dir, pos) * wpars.wavel() + t * wpars.phase();
+    float base = (glm::sin(arg) + 1) / 2;
+    // base^k from base^(k - 1), unless that is 0^-1
+    float pow_k1 = glm::pow(base, wpars.k - 1);
+    float pow_k = base > 0 ? pow_k1 * base : glm::pow(base, wpars.k);
+    out.offset[1] += 2 * wpars.a * ((1 - cal) * cal) * pow_k;
+    float basis = wpars.k * wpars.wavel() * wpars.a * ((1 - cal) * cal) * pow_k1 * glm::cos(arg);
+    out.normal += glm::vec4(-basis * wpars.dir[0], 1, -basis * wpars.dir[1], 0.0);
+}
+
+fluid::surface_sample fluid::simulate_surface(double t, const glm::vec2& pos, const fluid::ocean_surf_params& ospars) {
+    surface_sample out = {glm::vec4(0.0f), glm::vec4(0.0f)};
+    for (size_t i = 0; i < ospars.wpars.size(); ++i) {
+        single_wave_surface(t, pos, ospars.wpars[i], out);
+    }
+    swell_surface(make_swell_block(t, ospars), pos, out);
+    return out;
+}
+
+/* gaussian swells */
+void fluid::ocean_surf_params::retire_swells(double t) {
+    for (size_t i = this->swells.size(); i-- > 0;) {
+        if (t - this->swells[i].start >= this->swells[i].life) {
+            this->swells[i] = this->swells.back();
+            this->swells.pop_back();
+        }
     }
-    return normal;
+}
+
+fluid::swell_block fluid::make_swell_block(double t, const fluid::ocean_surf_params& ospars) {
+    swell_block block;
+    for (const auto& gp : ospars.swells) {
+        const double age = t - gp.start;
+        if (age < 0 || age >= gp.life) continue;
+        if (block.count.x == kMaxSwells) break;
+        const glm::vec2 centre = gp.dir * float(age) + gp.center;
+        block.swells[block.count.x++] = glm::vec4(centre.x, centre.y, gp.A, gp.sigma);
+    }
+    return block;
+}
+
+void fluid::swell_surface(const fluid::swell_block& block, const glm::vec2& pos, fluid::surface_sample& out) {
+    for (int i = 0; i < block.count.x; ++i) {
+        const glm::vec4& swell = block.swells[i];
+        const float dx = swell.x - pos.x, dz = swell.y - pos.y;
+        const float d2 = dx * dx + dz * dz;
+        const float r = 4 * swell.w;
+        if (d2 >= r * r) continue;
+        const float inv_s2 = 1 / (swell.w * swell.w);
+        const float g = swell.z * std::exp(-d2 * inv_s2 / 2);
+        out.offset[1] += g;
+        out.normal += glm::vec4(-g * inv_s2 * dx, 0.0f, g * inv_s2 * dz, 0.0f);
+    }
+    out.normal[1] += block.count.x;
 }
 
 float fluid::wave_params::wavel(void) const {
@@ -86,38 +121,216 @@ float fluid::wave_params::phase(void) const {
     return 2 / l * s;
 }
 
+namespace {
+    fluid::wave_params make_wave(int storminess, int count, int r) {
+        auto ret = fluid::wave_params {
+            // amp
+            r % 10560 / 7500.0f * (storminess/2 + 1),
+            // length
+            float(r % 5 + 2) / (storminess/2 + 1) / float(1.0 / (count + 1)),
+            // speed
+            r % 500 / 100000.0f * (storminess/2 + 1) * float(1.0 / (count + 1)),
+            // steepness
+            float(r % 5),
+            // direction
+            glm::vec2(r % 5503 / 5503.0f, r % 10073 / 10073.0f) * glm::pow(-1.0f, (r % 2) + 1.0f),
+            // lifetime
+            double(((r % 50) + 20) * 100000),
+            0
+        };
+        return ret;
+    }
+}
+
 fluid::wave_params fluid::generate_wave(int storminess, int count) {
-    int r = rand();
-    auto ret = fluid::wave_params {
-        // amp
-        r % 10560 / 7500.0f * (storminess/2 + 1),
-        // length
-        float(r % 5 + 2) / (storminess/2 + 1) / float(1.0 / (count + 1)),
-        // speed
-        r % 500 / 100000.0f * (storminess/2 + 1) * float(1.0 / (count + 1)),
-        // steepness
-        float(r % 5),
-        // direction
-        glm::vec2(r % 5503 / 5503.0f, r % 10073 / 10073.0f) * glm::pow(-1.0f, (r % 2) + 1.0f),
-        // lifetime
-        double(((r % 50) + 20) * 100000),
-        0
-    };
-    return ret;
+    return make_wave(storminess, count, rand());
+}
+fluid::wave_params fluid::generate_wave(int storminess, int count, std::mt19937& rng) {
+    return make_wave(storminess, count, int(rng() >> 1));
+}
+
+fluid::wave_pool::wave_pool(size_t capacity)
+    : a_(capacity), l_(capacity), s_(capacity), k_(capacity), dir_x_(capacity), dir_z_(capacity),
+      life_(capacity), time_(capacity) {
+}
+
+size_t fluid::wave_pool::size(void) const {
+    return size_;
+}
+
+size_t fluid::wave_pool::capacity(void) const {
+    return a_.size();
+}
+
+bool fluid::wave_pool::spawn(const wave_params& wave) {
+    if (size_ == capacity()) return false;
+    replace(size_++, wave);
+    return true;
+}
+
+void fluid::wave_pool::retire(size_t i) {
+    const size_t last = --size_;
+    a_[i] = a_[last];
+    l_[i] = l_[last];
+    s_[i] = s_[last];
+    k_[i] = k_[last];
+    dir_x_[i] = dir_x_[last];
+    dir_z_[i] = dir_z_[last];
+    life_[i] = life_[last];
+    time_[i] = time_[last];
+}
+
+void fluid::wave_pool::replace(size_t i, const wave_params& wave) {
+    a_[i] = wave.a;
+    l_[i] = wave.l;
+    s_[i] = wave.s;
+    k_[i] = wave.k;
+    dir_x_[i] = wave.dir[0];
+    dir_z_[i] = wave.dir[1];
+    life_[i] = wave.life;
+    time_[i] = wave.time;
+}
+
+void fluid::wave_pool::clear(void) {
+    size_ = 0;
+}
+
+fluid::wave_params fluid::wave_pool::operator[](size_t i) const {
+    return {a_[i], l_[i], s_[i], k_[i], glm::vec2(dir_x_[i], dir_z_[i]), life_[i], time_[i]};
+}
+
+void fluid::wave_pool::age(float dt) {
+    float* time = time_.data();
+    #pragma omp simd
+    for (size_t i = 0; i < size_; ++i) {
+        time[i] += dt;
+    }
+}
+
+bool fluid::wave_pool::expired(size_t i) const {
+    return life_[i] < time_[i];
 }
 
 void fluid::ocean_surf_params::elapse_time(double elapsed) {
-    for (size_t i = 0; i < this->wpars.size(); ++i) {
-        this->wpars[i].time += elapsed / 1000;
-        if (this->wpars[i].life < this->wpars[i].time) {
-            if (i < 3 + this->storminess) {
-                this->wpars[i] = generate_wave(this->storminess, i);
-            } else {
-                this->wpars.erase(this->wpars.begin() + i);
+    const size_t target = 3 + this->storminess;
+    this->wpars.age(elapsed / 1000);
+    // Backwards, so the wave retire() moves down has already been aged and
+    // checked
+    for (size_t i = this->wpars.size(); i-- > 0;) {
+        if (!this->wpars.expired(i)) continue;
+        if (i < target) {
+            this->wpars.replace(i, generate_wave(this->storminess, i, this->rng));
+        } else {
+            this->wpars.retire(i);
+        }
+    }
+    while (this->wpars.size() < target /*|| max_amp < target_amp*/) {
+        if (!this->wpars.spawn(generate_wave(this->storminess, this->wpars.size() + 1, this->rng))) break;
+    }
+}
+
+/* batched waves */
+float fluid::wave_lod(float freq, float spacing) {
+    return glm::clamp(2 - 2 * spacing * freq / glm::pi<float>(), 0.0f, 1.0f);
+}
+
+float fluid::wave_mean(float k) {
+    float mean = 1;
+    for (int j = 1; j <= int(k); ++j) {
+        mean *= (2 * j - 1) / (2.0f * j);
+    }
+    return mean;
+}
+
+fluid::wave_bank fluid::make_wave_bank(double t, const fluid::ocean_surf_params& ospars, float spacing) {
+    const double two_pi = 2 * glm::pi<double>();
+    const wave_pool& pool = ospars.wpars;
+    const size_t n = pool.size();
+    wave_bank bank;
+    bank.dir_x.reserve(n);
+    bank.dir_z.reserve(n);
+    bank.k.reserve(n);
+    bank.freq.reserve(n);
+    bank.phase.reserve(n);
+    bank.amp.reserve(n);
+    bank.slope.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        // wavel() and phase() of the wave
+        const float freq = 2 / pool.l()[i];
+        const float fade = spacing > 0 ? wave_lod(freq, spacing) : 1.0f;
+        const float cal = pool.time()[i] / pool.life()[i];
+        const float full = 2 * pool.a()[i] * ((1 - cal) * cal);
+        bank.level += (1 - fade) * full * wave_mean(pool.k()[i]);
+        if (fade == 0) continue;
+        const float amp = full * fade;
+        bank.dir_x.push_back(pool.dir_x()[i]);
+        bank.dir_z.push_back(pool.dir_z()[i]);
+        bank.k.push_back(pool.k()[i]);
+        bank.freq.push_back(freq);
+        bank.phase.push_back(std::fmod(t * double(freq * pool.s()[i]), two_pi));
+        bank.amp.push_back(amp);
+        bank.slope.push_back(pool.k()[i] * freq * amp / 2);
+    }
+    bank.normal_y = n;
+
+    bank.swells = make_swell_block(t, ospars);
+    bank.normal_y += bank.swells.count.x;
+    return bank;
+}
+
+namespace {
+    // One point at a time, with libm
+    void wave_batch_scalar(const fluid::wave_bank& bank, const float* x, const float* z, size_t count,
+            float* heights, glm::vec4* normals) {
+        for (size_t i = 0; i < count; ++i) {
+            float h = bank.level, nx = 0, nz = 0;
+            for (size_t w = 0; w < bank.size(); ++w) {
+                const float arg = (bank.dir_x[w] * x[i] + bank.dir_z[w] * z[i]) * bank.freq[w] + bank.phase[w];
+                const float base = (std::sin(arg) + 1) / 2;
+                h += bank.amp[w] * std::pow(base, bank.k[w]);
+                if (bank.k[w] != 0) {
+                    const float basis = bank.slope[w] * std::pow(base, bank.k[w] - 1) * std::cos(arg);
+                    nx -= basis * bank.dir_x[w];
+                    nz -= basis * bank.dir_z[w];
+                }
             }
+            fluid::surface_sample swells = {glm::vec4(0.0f), glm::vec4(0.0f)};
+            fluid::swell_surface(bank.swells, glm::vec2(x[i], z[i]), swells);
+            h += swells.offset[1];
+            nx += swells.normal[0];
+            nz += swells.normal[2];
+            if (heights) heights[i] = h;
+            if (normals) normals[i] = glm::vec4(nx, bank.normal_y, nz, 0.0f);
         }
     }
-    while (this->wpars.size() < 3 + this->storminess /*|| max_amp < target_amp*/) {
-        this->wpars.push_back(generate_wave(this->storminess, this->wpars.size() + 1));
+}
+
+fluid::batch_isa fluid::best_batch_isa(void) {
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+        && detail::simulate_batch_avx2(wave_bank(), nullptr, nullptr, 0, nullptr, nullptr);
+    return avx2 ? batch_isa::avx2 : batch_isa::sse2;
+#elif defined(__SSE2__)
+    return batch_isa::sse2;
+#else
+    return batch_isa::scalar;
+#endif
+}
+
+void fluid::simulate_batch(const wave_bank& bank, const float* x, const float* z, size_t count,
+        float* heights, glm::vec4* normals, batch_isa isa, batch_math math) {
+    if (math == batch_math::libm) {
+        wave_batch_scalar(bank, x, z, count, heights, normals);
+        return;
+    }
+    if (isa == batch_isa::avx2 && detail::simulate_batch_avx2(bank, x, z, count, heights, normals)) {
+        return;
+    }
+#if defined(__SSE2__)
+    if (isa != batch_isa::scalar) {
+        simd::wave_batch<fastmath::sse2>(bank, x, z, count, heights, normals);
+        return;
     }
+#endif
+    simd::wave_batch<fastmath::scalar>(bank, x, z, count, heights, normals);
 }
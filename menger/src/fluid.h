@@ -2,6 +2,7 @@
 #define __FLUID_H__
 
 #include <glm/glm.hpp>
+#include <random>
 #include <vector>
 
 namespace fluid {
@@ -19,32 +20,165 @@ namespace fluid {
         float phase(void) const;
     };
 
+    // A Gaussian swell moving in a straight line: dir is its velocity, and
+    // start and life are in the units of the t passed to the simulate
+    // functions. It is taken as zero past radius() (4 sigma, where it is
+    // below A e^-8), so queries skip the swells that do not reach them.
     struct gaussian_params {
         glm::vec2 dir;
         glm::vec2 center;
         float A;
         float sigma;
         double start;
+        double life = 100;
+
+        float radius(void) const { return 4 * sigma; }
     };
 
+    // A few waves under a raised cosine envelope of `radius`, moving along
+    // dir at `speed` units per second, with the crests moving through the
+    // envelope at the same speed again (deep water). The height peaks at
+    // amp halfway through its life. Times are in seconds; see packets.h.
     struct wave_packet {
         double start;
         glm::vec2 center;
+        glm::vec2 dir = glm::vec2(1.0f, 0.0f);
+        float speed = 1.0f;
+        float wavelength = 1.0f;
+        float amp = 0.1f;
+        float radius = 2.0f;
+        float life = 6.0f;
+    };
+
+    // The live waves, as a fixed capacity structure of arrays. Retiring a
+    // wave moves the last one into its slot, so spawn and retire are O(1)
+    // and the live waves stay packed at the front for the per frame loops.
+    class wave_pool {
+    public:
+        explicit wave_pool(size_t capacity = 256);
+
+        size_t size(void) const;
+        size_t capacity(void) const;
+        // Adds a wave at the end; false, and nothing added, when full
+        bool spawn(const wave_params& wave);
+        void retire(size_t i);
+        void replace(size_t i, const wave_params& wave);
+        void clear(void);
+        wave_params operator[](size_t i) const;
+
+        // Adds dt to the time of every wave
+        void age(float dt);
+        // Whether wave i has outlived its life
+        bool expired(size_t i) const;
+
+        // size() long columns
+        const float* a(void) const { return a_.data(); }
+        const float* l(void) const { return l_.data(); }
+        const float* s(void) const { return s_.data(); }
+        const float* k(void) const { return k_.data(); }
+        const float* dir_x(void) const { return dir_x_.data(); }
+        const float* dir_z(void) const { return dir_z_.data(); }
+        const float* life(void) const { return life_.data(); }
+        const float* time(void) const { return time_.data(); }
+    private:
+        std::vector<float> a_, l_, s_, k_, dir_x_, dir_z_, life_, time_;
+        size_t size_ = 0;
     };
 
     struct ocean_surf_params {
-        std::vector<wave_params> wpars;
-        gaussian_params gp;
+        wave_pool wpars;
+        std::vector<gaussian_params> swells;
         std::vector<wave_packet> wpacks;
 
         unsigned int storminess = 0;
+        // Draws the new waves of elapse_time, so a given seed always gives
+        // the same sea
+        std::mt19937 rng = std::mt19937(378);
 
+        // Ages the waves, replaces or retires the expired ones and tops the
+        // pool up to 3 + storminess
         void elapse_time(double elapsed);
+        // Drops the swells that are over by t
+        void retire_swells(double t);
     };
 
     glm::vec4 simulate_offset(double t, glm::vec2& pos, ocean_surf_params& ospars);
     glm::vec4 simulate_normal(double t, glm::vec2& pos, ocean_surf_params& ospars);
+    // simulate_offset and simulate_normal together, sharing the sin, pow
+    // and exp of each wave
+    struct surface_sample {
+        glm::vec4 offset;
+        glm::vec4 normal;
+    };
+    surface_sample simulate_surface(double t, const glm::vec2& pos, const ocean_surf_params& ospars);
+
+    // Swells the shaders take (MAX_SWELLS in shadersources.h)
+    const int kMaxSwells = 32;
+    // The swells under way at one instant, laid out as the std140 uniform
+    // block swell_block of the shaders, so the CPU queries and the GPU read
+    // the same bytes
+    struct swell_block {
+        glm::ivec4 count = glm::ivec4(0); // x: swells in use
+        // (centre x, centre z, A, sigma)
+        glm::vec4 swells[kMaxSwells];
+    };
+    // The first kMaxSwells swells under way at t
+    swell_block make_swell_block(double t, const ocean_surf_params& ospars);
+    // Adds the height and slope of the swells that reach pos to out, and 1
+    // to the normal's y per swell in the block
+    void swell_surface(const swell_block& block, const glm::vec2& pos, surface_sample& out);
+
     wave_params generate_wave(int storminess, int count);
+    // The same from rng instead of rand()
+    wave_params generate_wave(int storminess, int count, std::mt19937& rng);
+
+    // The waves of an ocean_surf_params at one instant, as a structure of
+    // arrays with the per wave terms folded in, for simulate_batch
+    struct wave_bank {
+        std::vector<float> dir_x, dir_z;
+        std::vector<float> freq;  // wavel()
+        std::vector<float> phase; // t * phase(), wrapped to one period
+        std::vector<float> amp;   // 2 a (1 - cal) cal
+        std::vector<float> slope; // k wavel() amp / 2
+        std::vector<float> k;
+
+        swell_block swells;
+
+        // simulate_normal adds a y of 1 per wave and per swell
+        float normal_y = 0;
+        // Height added everywhere: the mean of the faded part of each wave
+        float level = 0;
+
+        size_t size(void) const { return freq.size(); }
+    };
+    // With a spacing > 0, for points sampled that far apart (a heightfield
+    // cell, a far patch): waves too short for it are faded by wave_lod and
+    // dropped once they reach 0, keeping their 1 in normal_y. A wave fades
+    // toward its mean height (in level), not 0, so the water keeps its level.
+    wave_bank make_wave_bank(double t, const ocean_surf_params& ospars, float spacing = 0);
+
+    // Weight of a wave of angular wavenumber freq for samples spacing apart:
+    // 1 up to a quarter wavelength per sample, falling linearly to 0 at the
+    // Nyquist limit of half a wavelength; wave_lod in wave_fns is the same
+    float wave_lod(float freq, float spacing);
+    // Mean of ((sin + 1) / 2)^k over a period, C(2k, k) / 4^k for whole k
+    // (k is rounded down); wave_mean in wave_fns is the same
+    float wave_mean(float k);
+
+    enum class batch_isa { scalar, sse2, avx2 };
+    // Widest instruction set this CPU (and build) can run simulate_batch with
+    batch_isa best_batch_isa(void);
+    // libm: one point at a time with the standard library functions.
+    // fast: the fastmath.h approximations (errors listed there), which are
+    // also what the SSE2 and AVX2 paths run.
+    enum class batch_math { libm, fast };
+    // Height (the y of simulate_offset) and unnormalized normal (as
+    // simulate_normal) at each of `count` points (x[i], z[i]). Either output
+    // may be null. 8 points at a time with AVX2, 4 with SSE2; `isa` caps
+    // the instruction set, for comparing the paths.
+    void simulate_batch(const wave_bank& bank, const float* x, const float* z, size_t count,
+        float* heights, glm::vec4* normals, batch_isa isa = best_batch_isa(),
+        batch_math math = batch_math::fast);
 }
 
 #endif
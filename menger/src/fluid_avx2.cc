@@ -0,0 +1,40 @@
+// The AVX2 + FMA path of fluid::simulate_batch, only called once the CPU is
+// known to support both. The file is built for the baseline target and
+// switches to AVX2 just for the kernel headers: everything they depend on is
+// included first, so inline functions the linker may share with other files
+// (std::, glm::) are never compiled with AVX. GCC only; elsewhere the SSE2
+// path is used.
+#include "fluid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define FLUID_AVX2_REGION 1
+#include <immintrin.h>
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+// GCC does not define __AVX2__ for the region, so fastmath.h is told directly
+#define FASTMATH_AVX2 1
+#endif
+
+#include "fluid_simd.h"
+
+#if defined(FASTMATH_AVX2)
+bool fluid::detail::simulate_batch_avx2(const wave_bank& bank, const float* x, const float* z, size_t count,
+        float* heights, glm::vec4* normals) {
+    simd::wave_batch<fastmath::avx2>(bank, x, z, count, heights, normals);
+    return true;
+}
+#else
+bool fluid::detail::simulate_batch_avx2(const wave_bank&, const float*, const float*, size_t,
+        float*, glm::vec4*) {
+    return false;
+}
+#endif
+
+#ifdef FLUID_AVX2_REGION
+#pragma GCC pop_options
+#endif
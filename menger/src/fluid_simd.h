@@ -0,0 +1,111 @@
+#ifndef __FLUID_SIMD_H__
+#define __FLUID_SIMD_H__
+
+// The simulate_batch kernel, shared by the scalar and SSE2 (fluid.cc) and
+// AVX2 (fluid_avx2.cc) paths. Everything here is file local or a template on
+// the vector type (see fastmath.h), so each translation unit keeps its own
+// copy built for its own instruction set.
+
+#include "fastmath.h"
+#include "fluid.h"
+
+#include <algorithm>
+
+namespace fluid {
+    namespace detail {
+        // Defined in fluid_avx2.cc; false if that file was built without AVX2
+        bool simulate_batch_avx2(const wave_bank& bank, const float* x, const float* z, size_t count,
+            float* heights, glm::vec4* normals);
+    }
+}
+
+namespace {
+namespace simd {
+    template <typename V>
+    void wave_batch(const fluid::wave_bank& bank, const float* x, const float* z, size_t count,
+            float* heights, glm::vec4* normals) {
+        typedef typename V::reg reg;
+        const reg zero = V::set1(0.0f), one = V::set1(1.0f), half = V::set1(0.5f);
+        float tail_x[V::width], tail_z[V::width], out_h[V::width], out_nx[V::width], out_nz[V::width];
+        for (size_t i = 0; i < count; i += V::width) {
+            const size_t lanes = std::min<size_t>(V::width, count - i);
+            reg px, pz;
+            if (lanes == size_t(V::width)) {
+                px = V::load(x + i);
+                pz = V::load(z + i);
+            } else {
+                std::fill(tail_x, tail_x + V::width, 0.0f);
+                std::fill(tail_z, tail_z + V::width, 0.0f);
+                std::copy(x + i, x + i + lanes, tail_x);
+                std::copy(z + i, z + i + lanes, tail_z);
+                px = V::load(tail_x);
+                pz = V::load(tail_z);
+            }
+
+            reg h = V::set1(bank.level), nx = zero, nz = zero;
+            for (size_t w = 0; w < bank.size(); ++w) {
+                const reg dir_x = V::set1(bank.dir_x[w]), dir_z = V::set1(bank.dir_z[w]);
+                const reg arg = V::fmadd(V::fmadd(px, dir_x, V::mul(pz, dir_z)), V::set1(bank.freq[w]),
+                    V::set1(bank.phase[w]));
+                reg s, c;
+                fastmath::sincos<V>(arg, s, c);
+                const reg base = V::mul(V::add(s, one), half);
+                const int power = int(bank.k[w]);
+                if (bank.k[w] == 0) {
+                    h = V::add(h, V::set1(bank.amp[w]));
+                    continue;
+                }
+                // base^(k - 1), by multiplication when k is whole
+                reg p = one;
+                if (float(power) == bank.k[w] && power > 0) {
+                    for (int e = 1; e < power; ++e) {
+                        p = V::mul(p, base);
+                    }
+                } else {
+                    p = fastmath::pow<V>(base, V::set1(bank.k[w] - 1));
+                }
+                h = V::fmadd(V::set1(bank.amp[w]), V::mul(p, base), h);
+                const reg basis = V::mul(V::mul(V::set1(bank.slope[w]), p), c);
+                nx = V::sub(nx, V::mul(basis, dir_x));
+                nz = V::sub(nz, V::mul(basis, dir_z));
+            }
+
+            // Swells past their radius in every lane are skipped, and zeroed
+            // in the lanes they do not reach, as in swell_surface
+            for (int w = 0; w < bank.swells.count.x; ++w) {
+                const glm::vec4& swell = bank.swells.swells[w];
+                const reg dx = V::sub(V::set1(swell.x), px);
+                const reg dz = V::sub(V::set1(swell.y), pz);
+                const reg d2 = V::fmadd(dx, dx, V::mul(dz, dz));
+                const reg r2 = V::set1(16 * swell.w * swell.w);
+                if (!V::any_lt(d2, r2)) continue;
+                const float inv_s2 = 1 / (swell.w * swell.w);
+                const reg g = V::keep_lt(d2, r2,
+                    V::mul(V::set1(swell.z), fastmath::exp<V>(V::mul(d2, V::set1(-inv_s2 / 2)))));
+                h = V::add(h, g);
+                const reg base = V::mul(g, V::set1(inv_s2));
+                nx = V::sub(nx, V::mul(base, dx));
+                nz = V::fmadd(base, dz, nz);
+            }
+
+            if (heights) {
+                if (lanes == size_t(V::width)) {
+                    V::store(heights + i, h);
+                } else {
+                    V::store(out_h, h);
+                    std::copy(out_h, out_h + lanes, heights + i);
+                }
+            }
+            if (normals) {
+                V::store(out_nx, nx);
+                V::store(out_nz, nz);
+                for (size_t l = 0; l < lanes; ++l) {
+                    normals[i + l] = glm::vec4(out_nx[l], bank.normal_y, out_nz[l], 0.0f);
+                }
+            }
+        }
+    }
+}
+}
+
+#endif
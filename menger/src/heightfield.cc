@@ -0,0 +1,103 @@
+#include "heightfield.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+fluid::heightfield::heightfield(const glm::vec2& lo, const glm::vec2& hi, int resolution, update_policy policy)
+    : lo_(lo), hi_(hi), resolution_(std::max(1, resolution)), policy_(policy) {
+}
+
+void fluid::heightfield::set_resolution(int resolution) {
+    resolution = std::max(1, resolution);
+    if (resolution == resolution_) return;
+    resolution_ = resolution;
+    stale_ = true;
+    if (policy_ == update_policy::every_frame) fill();
+}
+
+int fluid::heightfield::resolution(void) const {
+    return resolution_;
+}
+
+void fluid::heightfield::set_policy(update_policy policy) {
+    policy_ = policy;
+}
+
+fluid::heightfield::update_policy fluid::heightfield::policy(void) const {
+    return policy_;
+}
+
+void fluid::heightfield::update(double t, const ocean_surf_params& ospars) {
+    bank_ = make_wave_bank(t, ospars);
+    stale_ = true;
+    if (policy_ == update_policy::every_frame) fill();
+}
+
+void fluid::heightfield::fill(void) {
+    const int side = resolution_ + 1;
+    const glm::vec2 cell = (hi_ - lo_) / float(resolution_);
+    heights_.resize(size_t(side) * side);
+    normals_.resize(size_t(side) * side);
+    std::vector<float> xs(side);
+    for (int i = 0; i < side; ++i) {
+        xs[i] = lo_.x + cell.x * i;
+    }
+    #pragma omp parallel for schedule(static)
+    for (int row = 0; row < side; ++row) {
+        const std::vector<float> zs(side, lo_.y + cell.y * row);
+        const size_t first = size_t(row) * side;
+        simulate_batch(bank_, xs.data(), zs.data(), side, &heights_[first], &normals_[first]);
+    }
+    stale_ = false;
+}
+
+fluid::surface_sample fluid::heightfield::sample(const glm::vec2& pos) {
+    if (stale_) fill();
+    const glm::vec2 grid = glm::clamp((pos - lo_) / (hi_ - lo_), 0.0f, 1.0f) * float(resolution_);
+    const int i = std::min(int(grid.x), resolution_ - 1);
+    const int j = std::min(int(grid.y), resolution_ - 1);
+    const float fx = grid.x - i, fz = grid.y - j;
+    const size_t side = resolution_ + 1;
+    const size_t c00 = j * side + i, c10 = c00 + 1, c01 = c00 + side, c11 = c01 + 1;
+    const float w00 = (1 - fx) * (1 - fz), w10 = fx * (1 - fz), w01 = (1 - fx) * fz, w11 = fx * fz;
+    const float h = heights_[c00] * w00 + heights_[c10] * w10 + heights_[c01] * w01 + heights_[c11] * w11;
+    const glm::vec4 n = normals_[c00] * w00 + normals_[c10] * w10 + normals_[c01] * w01 + normals_[c11] * w11;
+    return {glm::vec4(0.0f, h, 0.0f, 0.0f), n};
+}
+
+float fluid::heightfield::height(const glm::vec2& pos) {
+    return sample(pos).offset[1];
+}
+
+float fluid::heightfield::height_error(void) const {
+    // Along the wave, f = amp * b^k with b = (sin + 1) / 2, so
+    // d2f/dtheta2 = amp k / 2 ((k - 1) b^(k - 2) cos^2 / 2 - b^(k - 1) sin).
+    // That is at most amp k (k + 1) / 4 while b^(k - 2) <= 1 (k >= 2, or
+    // k = 1 where the first term drops out). Between 1 and 2, writing cos^2
+    // as 4 b (1 - b) bounds it by amp k (2k - 1) / 2.
+    const glm::vec2 cell = (hi_ - lo_) / float(resolution_);
+    float err = 0.0f;
+    for (size_t w = 0; w < bank_.size(); ++w) {
+        const float k = bank_.k[w];
+        float curvature = 0.0f;
+        if (k == 0) {
+            continue;
+        } else if (k == 1 || k >= 2) {
+            curvature = std::abs(bank_.amp[w]) * k * (k + 1) / 4;
+        } else if (k > 1) {
+            curvature = std::abs(bank_.amp[w]) * k * (2 * k - 1) / 2;
+        } else {
+            return std::numeric_limits<float>::infinity();
+        }
+        const float fx = bank_.freq[w] * bank_.dir_x[w] * cell.x, fz = bank_.freq[w] * bank_.dir_z[w] * cell.y;
+        err += curvature * (fx * fx + fz * fz) / 8;
+    }
+    for (int i = 0; i < bank_.swells.count.x; ++i) {
+        // |d2g/dx2| <= A / sigma^2 for a Gaussian bump, plus the jump of at
+        // most A e^-8 where it is cut off at 4 sigma
+        const glm::vec4& swell = bank_.swells.swells[i];
+        err += std::abs(swell.z) * (glm::dot(cell, cell) / (8 * swell.w * swell.w) + std::exp(-8.0f));
+    }
+    return err;
+}
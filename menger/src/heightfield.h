@@ -0,0 +1,58 @@
+#ifndef __HEIGHTFIELD_H__
+#define __HEIGHTFIELD_H__
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "fluid.h"
+
+// The ocean surface sampled once on a regular grid, so that CPU queries
+// (ship placement, and whatever needs the water next) are a bilinear lookup
+// instead of a full wave sum. The grid is filled with simulate_batch, one
+// row per OpenMP thread.
+//
+// Heights are off from simulate_surface by at most height_error(), from the
+// usual bilinear bound h^2 / 8 * |f''| per axis with |f''| bounded per wave.
+// Normals are interpolated the same way, unnormalized, so their error is of
+// the order of the cell size times the curvature. Outside the grid the edge
+// values are used.
+namespace fluid {
+    class heightfield {
+    public:
+        // every_frame: update() fills the grid straight away.
+        // on_demand: update() only records the time; the first sample after
+        // it fills the grid, so frames with no queries cost nothing.
+        enum class update_policy { every_frame, on_demand };
+
+        heightfield(const glm::vec2& lo = glm::vec2(-20.0f), const glm::vec2& hi = glm::vec2(20.0f),
+            int resolution = 128, update_policy policy = update_policy::on_demand);
+
+        // Cells along each side
+        void set_resolution(int resolution);
+        int resolution(void) const;
+        void set_policy(update_policy policy);
+        update_policy policy(void) const;
+
+        void update(double t, const ocean_surf_params& ospars);
+        // Same offset and normal as simulate_surface at the time of the
+        // last update
+        surface_sample sample(const glm::vec2& pos);
+        float height(const glm::vec2& pos);
+        // Bound on |height(pos) - simulate_surface(...).offset.y| inside the
+        // grid; infinite if some wave has a steepness in (0, 1)
+        float height_error(void) const;
+    private:
+        void fill(void);
+
+        glm::vec2 lo_, hi_;
+        int resolution_;
+        update_policy policy_;
+        wave_bank bank_;
+        bool stale_ = true;
+        // (resolution_ + 1)^2 samples, row by row along z
+        std::vector<float> heights_;
+        std::vector<glm::vec4> normals_;
+    };
+}
+
+#endif
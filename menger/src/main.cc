@@ -1,9 +1,14 @@
-#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <memory>
 #include <chrono>
+#include <future>
+#include <iterator>
+#include <list>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -20,17 +25,28 @@
 #include "ship.h"
 #include "camera.h"
 #include "shaders.h"
+#include "bench.h"
+#include "meshcache.h"
+#include "meshio.h"
+#include "meshopt.h"
+#include "meshlet.h"
+#include "meshpack.h"
+#include "heightfield.h"
+#include "spectral.h"
+#include "packets.h"
 
 int window_width = 800, window_height = 600;
 
 // VBO and VAO descriptors.
-enum { kVertexBuffer, kIndexBuffer, kNumVbos };
+enum { kVertexBuffer, kIndexBuffer, kInstanceBuffer, kNormalBuffer, kNumVbos };
 
 // These are our VAOs.
-enum { kMengerVao, kFloorVao, kOceanVao, kLightVao, kShipVao, kSeabedVao, kNumVaos };
+enum { kFloorVao, kOceanVao, kLightVao, kShipVao, kSeabedVao, kMengerInstancedVao, kNumVaos };
 
 GLuint g_array_objects[kNumVaos];  // This will store the VAO descriptors.
 GLuint g_buffer_objects[kNumVaos][kNumVbos];  // These will store VBO descriptors.
+glm::mat4 g_unpack[kNumVaos];  // position decode for PACKED_VAO_SETUP meshes
+GLenum g_index_types[kNumVaos];
 
 /*********************************************************/
 /*** easier uniform passing ******************************/
@@ -38,7 +54,8 @@ GLuint g_buffer_objects[kNumVaos][kNumVbos];  // These will store VBO descriptor
 #define GET_UNIFORM_LOC(PREFIX, NAME) GLint ULNAME(PREFIX, NAME) = 0; CHECK_GL_ERROR(ULNAME(PREFIX, NAME) = glGetUniformLocation(PREFIX ## _program_id, #NAME));
 
 #define VAO(NAME) k ## NAME ## Vao
-#define BASE_VAO_SETUP(NAME, VERT_DIMEN, FACE_VERTS, VEC_PREFIX) CHECK_GL_ERROR(glBindVertexArray(g_array_objects[VAO(NAME)]));\
+#define BASE_VAO_SETUP(NAME, VERT_DIMEN, FACE_VERTS, VEC_PREFIX) const std::vector<unsigned int> VEC_PREFIX ## _remap = OptimizeStaticMesh(#NAME, VEC_PREFIX ## _vertices, VEC_PREFIX ## _faces);\
+CHECK_GL_ERROR(glBindVertexArray(g_array_objects[VAO(NAME)]));\
 CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[VAO(NAME)][0]));\
 CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[VAO(NAME)][kVertexBuffer]));\
 CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * VEC_PREFIX ## _vertices.size() * VERT_DIMEN, VEC_PREFIX ## _vertices.data(), GL_STATIC_DRAW));\
@@ -46,8 +63,85 @@ CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));\
 CHECK_GL_ERROR(glEnableVertexAttribArray(0));\
 CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[VAO(NAME)][kIndexBuffer]));\
 CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * VEC_PREFIX ## _faces.size() * FACE_VERTS, VEC_PREFIX ## _faces.data(), GL_STATIC_DRAW))
+// Triangle meshes whose vertex shader takes an `unpack` matrix: uploaded in
+// the compact layout when g_compact_vertices is set
+#define PACKED_VAO_SETUP(NAME, VEC_PREFIX) const std::vector<unsigned int> VEC_PREFIX ## _remap = OptimizeStaticMesh(#NAME, VEC_PREFIX ## _vertices, VEC_PREFIX ## _faces);\
+CHECK_GL_ERROR(glBindVertexArray(g_array_objects[VAO(NAME)]));\
+CHECK_GL_ERROR(glGenBuffers(kNumVbos, &g_buffer_objects[VAO(NAME)][0]));\
+g_unpack[VAO(NAME)] = UploadStaticMesh(g_buffer_objects[VAO(NAME)], VEC_PREFIX ## _vertices, VEC_PREFIX ## _faces, g_index_types[VAO(NAME)])
 
 
+/*********************************************************/
+/*** Static meshes ***************************************/
+
+// Reorders a triangle mesh for the post-transform cache, overdraw and vertex
+// fetch before it is uploaded. Returns the vertex remap, so attributes kept
+// in other arrays (ship normals) can follow. Patch meshes are left alone.
+std::vector<unsigned int> OptimizeStaticMesh(const char* name, std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>& faces) {
+	const float before = meshopt::acmr(faces, vertices.size());
+	std::vector<unsigned int> new_index = meshopt::optimize(vertices, faces);
+	std::cout << name << ": ACMR " << before << " -> " << meshopt::acmr(faces, vertices.size()) << std::endl;
+	return new_index;
+}
+
+std::vector<unsigned int> OptimizeStaticMesh(const char*, std::vector<glm::vec4>&, std::vector<glm::uvec4>&) {
+	return std::vector<unsigned int>();
+}
+
+// Set by -c: positions as 16-bit integers against the mesh bounds, normals
+// octahedral, indices 16-bit, against a base vertex per batch on large
+// Menger meshes (see meshpack.h)
+bool g_compact_vertices = false;
+
+// Fills the position buffer of the bound VAO and enables attribute 0.
+// Returns the bytes uploaded.
+size_t UploadPositions(GLuint vbo, const glm::vec4* vertices, size_t vertex_count, const meshpack::bounds& bounds) {
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+	if (g_compact_vertices) {
+		std::vector<glm::i16vec4> packed;
+		meshpack::quantize_positions(vertices, vertex_count, bounds, packed);
+		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::i16vec4) * vertex_count, packed.data(), GL_STATIC_DRAW));
+		CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_SHORT, GL_FALSE, 0, 0));
+	} else {
+		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * vertex_count, vertices, GL_STATIC_DRAW));
+		CHECK_GL_ERROR(glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0));
+	}
+	CHECK_GL_ERROR(glEnableVertexAttribArray(0));
+	return (g_compact_vertices ? sizeof(glm::i16vec4) : sizeof(glm::vec4)) * vertex_count;
+}
+
+// Fills the index buffer of the bound VAO, narrowed to 16 bits in the
+// compact layout when the vertex count allows. Returns the bytes uploaded.
+size_t UploadIndices(GLuint vbo, const glm::u16vec3* faces, size_t face_count, size_t, GLenum& index_type) {
+	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo));
+	CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::u16vec3) * face_count, faces, GL_STATIC_DRAW));
+	index_type = GL_UNSIGNED_SHORT;
+	return sizeof(glm::u16vec3) * face_count;
+}
+
+size_t UploadIndices(GLuint vbo, const glm::uvec3* faces, size_t face_count, size_t vertex_count, GLenum& index_type) {
+	if (g_compact_vertices && vertex_count <= 65536) {
+		std::vector<glm::u16vec3> narrow;
+		std::vector<meshpack::batch> batches;
+		std::vector<unsigned int> source;
+		meshpack::narrow_faces(faces, face_count, vertex_count, {}, narrow, batches, source);
+		return UploadIndices(vbo, narrow.data(), face_count, vertex_count, index_type);
+	}
+	CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo));
+	CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uvec3) * face_count, faces, GL_STATIC_DRAW));
+	index_type = GL_UNSIGNED_INT;
+	return sizeof(glm::uvec3) * face_count;
+}
+
+// Returns the matrix the vertex shader's `unpack` uniform needs
+glm::mat4 UploadStaticMesh(const GLuint* vbos, const std::vector<glm::vec4>& vertices,
+		const std::vector<glm::uvec3>& faces, GLenum& index_type) {
+	const meshpack::bounds bounds = meshpack::mesh_bounds(vertices.data(), vertices.size());
+	UploadPositions(vbos[kVertexBuffer], vertices.data(), vertices.size(), bounds);
+	UploadIndices(vbos[kIndexBuffer], faces.data(), faces.size(), vertices.size(), index_type);
+	return g_compact_vertices ? meshpack::unpack_matrix(bounds) : glm::mat4(1.0f);
+}
+
 /*********************************************************/
 /*** ??? *************************************************/
 
@@ -104,16 +198,363 @@ void getFloorQuad(std::vector<glm::vec4>& vertices, std::vector<glm::uvec4>& ind
 		}
 }
 
-void SaveObj(const std::string& file,
-	const std::vector<glm::vec4>& vertices,
-	const std::vector<glm::uvec3>& indices) {
+/*********************************************************/
+/*** Menger meshes ***************************************/
+
+// A Menger mesh with its own VAO, used both for cached levels and for the
+// sponges the chunks of levels past 4 are drawn with.
+struct MengerMesh {
+	GLuint vao;
+	GLuint vbos[kNumVbos];
+	GLsizei index_count;
+	GLenum index_type;
+	std::vector<meshpack::batch> batches; // drawn each with its base vertex
+	size_t bytes;
+	std::vector<meshlet::cluster> clusters;
+};
+
+// Every level is quantized against the whole sponge, so one unpack matrix
+// serves them all.
+const meshpack::bounds kMengerBounds = {glm::vec3(0.0f), glm::vec3(0.5f)};
+
+glm::mat4 MengerUnpack() {
+	return g_compact_vertices ? meshpack::unpack_matrix(kMengerBounds) : glm::mat4(1.0f);
+}
+
+// Fills the buffers of the bound VAO as one batch, or in the compact
+// layout as 16-bit batches against a base vertex each when the mesh is too
+// large for plain 16-bit indices. Batches end only where a cluster starts,
+// so a cluster never straddles two base vertices.
+size_t UploadMengerBuffers(MengerMesh& mesh, const glm::vec4* vertices, size_t vertex_count,
+		const glm::u16vec3* faces, size_t face_count, const std::vector<size_t>&) {
+	mesh.batches = {{0, face_count, 0}};
+	return UploadPositions(mesh.vbos[kVertexBuffer], vertices, vertex_count, kMengerBounds)
+		+ UploadIndices(mesh.vbos[kIndexBuffer], faces, face_count, vertex_count, mesh.index_type);
+}
+
+size_t UploadMengerBuffers(MengerMesh& mesh, const glm::vec4* vertices, size_t vertex_count,
+		const glm::uvec3* faces, size_t face_count, const std::vector<size_t>& cuts) {
+	std::vector<glm::u16vec3> narrow;
+	std::vector<unsigned int> source;
+	if (g_compact_vertices && vertex_count > 65536
+			&& meshpack::narrow_faces(faces, face_count, vertex_count, cuts, narrow, mesh.batches, source)) {
+		std::vector<glm::vec4> batched(source.size());
+		for (size_t i = 0; i < source.size(); ++i) {
+			batched[i] = vertices[source[i]];
+		}
+		return UploadPositions(mesh.vbos[kVertexBuffer], batched.data(), batched.size(), kMengerBounds)
+			+ UploadIndices(mesh.vbos[kIndexBuffer], narrow.data(), face_count, batched.size(), mesh.index_type);
+	}
+	mesh.batches = {{0, face_count, 0}};
+	return UploadPositions(mesh.vbos[kVertexBuffer], vertices, vertex_count, kMengerBounds)
+		+ UploadIndices(mesh.vbos[kIndexBuffer], faces, face_count, vertex_count, mesh.index_type);
+}
+
+template <typename Face>
+MengerMesh UploadMengerMesh(const glm::vec4* vertices, size_t vertex_count, const Face* faces, size_t face_count,
+		std::vector<meshlet::cluster> clusters = {}) {
+	std::vector<size_t> cuts;
+	for (const auto& c : clusters) {
+		cuts.push_back(c.first_face);
+	}
+	MengerMesh mesh;
+	mesh.clusters.swap(clusters);
+	mesh.index_count = face_count * 3;
+	CHECK_GL_ERROR(glGenVertexArrays(1, &mesh.vao));
+	CHECK_GL_ERROR(glBindVertexArray(mesh.vao));
+	CHECK_GL_ERROR(glGenBuffers(kNumVbos, mesh.vbos));
+	mesh.bytes = UploadMengerBuffers(mesh, vertices, vertex_count, faces, face_count, cuts);
+	return mesh;
+}
+
+template <typename Face>
+MengerMesh UploadMengerMesh(const std::vector<glm::vec4>& vertices, const std::vector<Face>& faces,
+		std::vector<meshlet::cluster> clusters = {}) {
+	return UploadMengerMesh(vertices.data(), vertices.size(), faces.data(), faces.size(), std::move(clusters));
+}
 
-	std::ofstream fout;
-	fout.open(file);
-	for(const auto& v: vertices)
-		fout << "v " << v[0] << " " << v[1] << " " << v[2] << std::endl;
-	for(const auto& f: indices)
-		fout << "f " << (1+f[0]) << " " << (1+f[1]) << " " << (1+f[2]) << std::endl;
+void DeleteMengerMesh(MengerMesh& mesh) {
+	CHECK_GL_ERROR(glDeleteBuffers(kNumVbos, mesh.vbos));
+	CHECK_GL_ERROR(glDeleteVertexArrays(1, &mesh.vao));
+}
+
+// Clusters outside the frustum, or entirely back facing, are skipped and
+// the ranges left are drawn in one multi draw, split where the index
+// batches change base vertex.
+struct MengerView {
+	meshlet::frustum frustum;
+	glm::vec3 eye;
+	bool cull_back_faces;
+};
+std::vector<glm::uvec2> g_cluster_ranges;
+std::vector<GLsizei> g_cluster_counts;
+std::vector<const GLvoid*> g_cluster_offsets;
+std::vector<GLint> g_cluster_bases;
+
+size_t DrawMengerMesh(const MengerMesh& mesh, const MengerView* view) {
+	CHECK_GL_ERROR(glBindVertexArray(mesh.vao));
+	size_t kept = mesh.index_count / 3;
+	g_cluster_ranges.clear();
+	if (view && !mesh.clusters.empty()) {
+		kept = meshlet::cull(mesh.clusters, view->frustum, view->eye, view->cull_back_faces, g_cluster_ranges);
+		if (g_cluster_ranges.empty()) return 0;
+	} else {
+		g_cluster_ranges.push_back(glm::uvec2(0, mesh.index_count / 3));
+	}
+	const size_t face_bytes = (mesh.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)) * 3;
+	g_cluster_counts.clear();
+	g_cluster_offsets.clear();
+	g_cluster_bases.clear();
+	// Ranges and batches both ascend, so one walk pairs them up
+	size_t b = 0;
+	for (const auto& range : g_cluster_ranges) {
+		for (size_t face = range.x, end = size_t(range.x) + range.y; face < end;) {
+			while (mesh.batches[b].first_face + mesh.batches[b].face_count <= face) ++b;
+			const meshpack::batch& batch = mesh.batches[b];
+			const size_t last = std::min(end, batch.first_face + batch.face_count);
+			g_cluster_counts.push_back((last - face) * 3);
+			g_cluster_offsets.push_back(reinterpret_cast<const GLvoid*>(face * face_bytes));
+			g_cluster_bases.push_back(batch.base_vertex);
+			face = last;
+		}
+	}
+	CHECK_GL_ERROR(glMultiDrawElementsBaseVertex(GL_TRIANGLES, g_cluster_counts.data(), mesh.index_type,
+		g_cluster_offsets.data(), g_cluster_counts.size(), g_cluster_bases.data()));
+	return kept;
+}
+
+/*********************************************************/
+/*** Menger level cache **********************************/
+
+// Levels 0-4 stay on the GPU after they are first built, so going back to
+// one is just a VAO bind. Least recently used levels are dropped once the
+// cache outgrows its budget.
+struct MengerCacheEntry {
+	int level;
+	bool cull_hidden;
+	bool weld_vertices;
+	bool merge_faces;
+	MengerMesh mesh;
+};
+std::list<MengerCacheEntry> g_menger_cache; // most recently used first
+size_t g_menger_cache_bytes = 0;
+size_t g_menger_cache_hits = 0;
+size_t g_menger_cache_misses = 0;
+const size_t kMengerCacheBudget = size_t(128) << 20;
+
+const MengerMesh* g_menger_mesh = nullptr; // what is on screen
+
+// Geometry for a level missing from the cache. It is built on a worker
+// thread while the previous level stays on screen, and only swapped in
+// once it is ready. Levels found in the on-disk mesh cache are mapped
+// instead and uploaded straight from the mapping.
+struct MengerBuild {
+	int level;
+	bool cull_hidden;
+	bool weld_vertices;
+	bool merge_faces;
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::uvec3> faces;
+	meshcache::mapped_mesh mapped;
+	std::vector<meshlet::cluster> clusters;
+};
+std::future<MengerBuild> g_menger_build;
+
+MengerMesh* FindCachedMengerMesh(int level, bool cull_hidden, bool weld_vertices, bool merge_faces) {
+	for (auto it = g_menger_cache.begin(); it != g_menger_cache.end(); ++it) {
+		if (it->level == level && it->cull_hidden == cull_hidden && it->weld_vertices == weld_vertices
+				&& it->merge_faces == merge_faces) {
+			g_menger_cache.splice(g_menger_cache.begin(), g_menger_cache, it);
+			return &g_menger_cache.front().mesh;
+		}
+	}
+	return nullptr;
+}
+
+void CacheMengerBuild(MengerBuild& build) {
+	const bool mapped = build.mapped.valid();
+	const size_t vertex_count = mapped ? build.mapped.vertex_count() : build.vertices.size();
+	const size_t face_count = mapped ? build.mapped.face_count() : build.faces.size();
+	g_menger_cache.push_front({build.level, build.cull_hidden, build.weld_vertices, build.merge_faces,
+		mapped ? UploadMengerMesh(build.mapped.vertices(), vertex_count, build.mapped.faces(), face_count,
+				std::move(build.clusters))
+			: UploadMengerMesh(build.vertices, build.faces, std::move(build.clusters))});
+	std::cout << "menger level " << build.level << ": "
+		<< vertex_count << " vertices, " << face_count << " triangles ("
+		<< Menger::cube_count(build.level) * 12 << " before culling), "
+		<< g_menger_cache.front().mesh.bytes
+		<< " bytes on the GPU" << (mapped ? ", from the mesh cache" : "") << std::endl;
+	g_menger_cache_bytes += g_menger_cache.front().mesh.bytes;
+
+	// Never drop the newest level or the one still on screen, even if
+	// that leaves the cache over budget.
+	auto it = std::prev(g_menger_cache.end());
+	while (g_menger_cache_bytes > kMengerCacheBudget && it != g_menger_cache.begin()) {
+		auto prev = std::prev(it);
+		if (&it->mesh != g_menger_mesh) {
+			g_menger_cache_bytes -= it->mesh.bytes;
+			DeleteMengerMesh(it->mesh);
+			g_menger_cache.erase(it);
+		}
+		it = prev;
+	}
+}
+
+// Called every frame. Picks up a finished build, then shows the requested
+// level if it is cached or starts building it if not. Never waits on the
+// worker.
+void UpdateMengerMesh(const Menger& menger, bool switched) {
+	if (g_menger_build.valid()
+			&& g_menger_build.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		MengerBuild build = g_menger_build.get();
+		CacheMengerBuild(build);
+	}
+
+	MengerMesh* cached = FindCachedMengerMesh(menger.nesting_level(), menger.cull_hidden(),
+		menger.weld_vertices(), menger.merge_faces());
+	if (switched) {
+		++(cached ? g_menger_cache_hits : g_menger_cache_misses);
+		std::cout << "menger cache: " << g_menger_cache_hits << " hits, " << g_menger_cache_misses
+			<< " misses, " << g_menger_cache.size() << " levels in " << g_menger_cache_bytes << " bytes" << std::endl;
+	}
+	if (cached) {
+		g_menger_mesh = cached;
+	} else if (!g_menger_build.valid()) {
+		// The worker gets its own copy, so later key presses can't race it.
+		g_menger_build = std::async(std::launch::async, [menger]() {
+			MengerBuild build {menger.nesting_level(), menger.cull_hidden(), menger.weld_vertices(), menger.merge_faces()};
+			build.mapped = menger.map_cached();
+			if (!build.mapped.valid()) {
+				menger.generate_geometry(build.vertices, build.faces);
+				// grouped by facing first, so whole clusters can be culled
+				const std::vector<size_t> groups = meshlet::sort_faces(build.vertices, build.faces);
+				meshopt::optimize(build.vertices, build.faces, &groups);
+				menger.save_cached(build.vertices, build.faces);
+				build.clusters = meshlet::build(build.vertices.data(), build.vertices.size(),
+					build.faces.data(), build.faces.size());
+			} else {
+				build.clusters = meshlet::build(build.mapped.vertices(), build.mapped.vertex_count(),
+					build.mapped.faces(), build.mapped.face_count());
+			}
+			return build;
+		});
+	}
+}
+
+/*********************************************************/
+/*** Menger chunks ***************************************/
+
+// Levels past 4 are drawn as instanced copies of a small sponge, one per
+// chunk (see Menger::chunked), through the instanced menger program. Each
+// frame the chunks in view are sorted into one instance list per sponge
+// level by how many pixels they span, so far chunks are drawn as plain cubes
+// and only the nearest get every level of holes.
+struct MengerChunks {
+	std::vector<MengerMesh> lods; // sponge levels 0 to Menger::chunk_depth()
+	std::vector<glm::u16vec4> cells;
+	float chunk_size = 1.0f;
+	std::vector<std::vector<glm::u16vec4>> drawn;
+};
+MengerChunks g_menger_chunks;
+
+void ClearMengerChunks() {
+	for (auto& lod : g_menger_chunks.lods) {
+		DeleteMengerMesh(lod);
+	}
+	g_menger_chunks = MengerChunks();
+}
+
+void BuildMengerChunks(const Menger& menger) {
+	ClearMengerChunks();
+	menger.generate_chunk_cells(g_menger_chunks.cells);
+	g_menger_chunks.chunk_size = menger.chunk_size();
+	g_menger_chunks.drawn.resize(Menger::chunk_depth() + 1);
+	size_t bytes = sizeof(glm::u16vec4) * g_menger_chunks.cells.size();
+	Menger lod = menger;
+	std::vector<glm::vec4> vertices;
+	std::vector<glm::uvec3> faces;
+	for (int level = 0; level <= Menger::chunk_depth(); ++level) {
+		lod.set_nesting_level(level);
+		lod.generate_geometry(vertices, faces);
+		meshopt::optimize(vertices, faces);
+		g_menger_chunks.lods.push_back(UploadMengerMesh(vertices, faces));
+		const MengerMesh& mesh = g_menger_chunks.lods.back();
+		bytes += mesh.bytes;
+		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[kInstanceBuffer]));
+		CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_UNSIGNED_SHORT, GL_FALSE, 0, 0));
+		CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+		CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));
+	}
+	std::cout << "menger level " << menger.nesting_level() << ": " << g_menger_chunks.cells.size()
+		<< " chunks drawn as level 0-" << Menger::chunk_depth() << " sponges, "
+		<< bytes << " bytes on the GPU" << std::endl;
+}
+
+// lod_pixel: world units a pixel covers per unit of distance. Returns the
+// triangles drawn.
+size_t DrawMengerChunks(const MengerView& view, const MengerView* cull, float lod_pixel) {
+	MengerChunks& chunks = g_menger_chunks;
+	for (auto& drawn : chunks.drawn) {
+		drawn.clear();
+	}
+	const float radius = chunks.chunk_size * 0.8660254f;
+	for (const glm::u16vec4& cell : chunks.cells) {
+		const glm::vec3 centre = (glm::vec3(cell) + 0.5f) * chunks.chunk_size - 0.5f;
+		if (cull && !meshlet::visible(cull->frustum, centre, radius)) continue;
+		const float distance = std::max(glm::length(centre - view.eye) - radius, 1e-4f);
+		chunks.drawn[Menger::chunk_lod(chunks.chunk_size / (distance * lod_pixel))].push_back(cell);
+	}
+	size_t triangles = 0;
+	for (size_t level = 0; level < chunks.lods.size(); ++level) {
+		const std::vector<glm::u16vec4>& drawn = chunks.drawn[level];
+		if (drawn.empty()) continue;
+		const MengerMesh& mesh = chunks.lods[level];
+		CHECK_GL_ERROR(glBindVertexArray(mesh.vao));
+		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[kInstanceBuffer]));
+		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::u16vec4) * drawn.size(), drawn.data(), GL_STREAM_DRAW));
+		const size_t face_bytes = (mesh.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint)) * 3;
+		for (const meshpack::batch& batch : mesh.batches) {
+			CHECK_GL_ERROR(glDrawElementsInstancedBaseVertex(GL_TRIANGLES, batch.face_count * 3, mesh.index_type,
+				reinterpret_cast<const GLvoid*>(batch.first_face * face_bytes), drawn.size(), batch.base_vertex));
+		}
+		triangles += size_t(mesh.index_count / 3) * drawn.size();
+	}
+	return triangles;
+}
+
+/*********************************************************/
+/*** Saving **********************************************/
+
+std::future<void> g_menger_save;
+
+// Exports a snapshot of the sponge's current settings on a worker thread, in
+// the format picked by the file extension,
+// taking the geometry from the mesh cache when it is there, so the window
+// keeps drawing while the file is written.
+void SaveMenger(const Menger& menger, const std::string& file) {
+	if (g_menger_save.valid() && g_menger_save.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		std::cout << "still saving, try again in a moment" << std::endl;
+		return;
+	}
+	g_menger_save = std::async(std::launch::async, [menger, file]() {
+		auto start = std::chrono::steady_clock::now();
+		bool saved;
+		meshcache::mapped_mesh mapped = menger.map_cached();
+		if (mapped.valid()) {
+			saved = meshio::save(file, mapped.vertices(), mapped.vertex_count(), mapped.faces(), mapped.face_count());
+		} else {
+			std::vector<glm::vec4> obj_vertices;
+			std::vector<glm::uvec3> obj_faces;
+			menger.generate_geometry(obj_vertices, obj_faces);
+			saved = meshio::save(file, obj_vertices.data(), obj_vertices.size(), obj_faces.data(), obj_faces.size());
+		}
+		std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+		if (saved) {
+			std::cout << "saved model to " << file << " in " << took.count() << " ms" << std::endl;
+		} else {
+			std::cout << "could not save model to " << file << std::endl;
+		}
+	});
 }
 
 void ErrorCallback(int error, const char* description) {
@@ -137,11 +578,22 @@ int g_init_wave = 0;
 bool g_wave_type = false;
 bool g_render_lights = false;
 bool g_show_menger = false;
+bool g_instanced_menger = false;
+bool g_render_cells = false;
+bool g_cull_clusters = true;
 
 bool g_launch_ships = false;
 unsigned int g_storminess = 3;
 bool g_dynamic_waves = false;
 bool g_caustics = false;
+// Cells per side of the per-frame ocean heightfield CPU queries read from
+// (menger -f[N]); 0 evaluates the waves at every query instead
+int g_ocean_grid_resolution = 0;
+// Samples per side of the FFT ocean tile that replaces the wave list
+// (menger -o[N]); 0 keeps the wave list
+int g_spectral_resolution = 0;
+// Ships leave wakes of wave packets (menger -w)
+bool g_ship_wakes = false;
 
 auto g_lt = std::chrono::system_clock::now();
 
@@ -173,12 +625,14 @@ void KeyCallback(GLFWwindow* window,
 	// you may want to re-organize this piece of code.
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
 		glfwSetWindowShouldClose(window, GL_TRUE);
+	} else if (key == GLFW_KEY_S && (mods & GLFW_MOD_CONTROL) && action == GLFW_RELEASE && g_menger->chunked()) {
+		std::cout << "level " << g_menger->nesting_level() << " is too large to save" << std::endl;
 	} else if (key == GLFW_KEY_S && mods == GLFW_MOD_CONTROL && action == GLFW_RELEASE) {
-		std::vector<glm::vec4> obj_vertices;
-		std::vector<glm::uvec3> obj_faces;
-        g_menger->generate_geometry(obj_vertices, obj_faces);
-		SaveObj(std::string("geometry.obj"), obj_vertices, obj_faces);
-		std::cout << "saved model to geometry.obj" << std::endl;
+		SaveMenger(*g_menger, "geometry.obj");
+	} else if (key == GLFW_KEY_S && mods == (GLFW_MOD_CONTROL | GLFW_MOD_SHIFT) && action == GLFW_RELEASE) {
+		SaveMenger(*g_menger, "geometry.ply");
+	} else if (key == GLFW_KEY_S && mods == (GLFW_MOD_CONTROL | GLFW_MOD_ALT) && action == GLFW_RELEASE) {
+		SaveMenger(*g_menger, "geometry.stl");
 	} else if (key == GLFW_KEY_W) { // move forwards
         if (action == GLFW_RELEASE && g_should_move == MovementDirection::FORWARD) {
             g_should_move = MovementDirection::NONE;
@@ -279,8 +733,22 @@ void KeyCallback(GLFWwindow* window,
         g_show_menger = !g_show_menger;
     } else if (key == GLFW_KEY_R && action == GLFW_PRESS) {
         g_camera.reset();
+    } else if (key == GLFW_KEY_H && action == GLFW_RELEASE && g_menger) {
+        g_menger->set_cull_hidden(!g_menger->cull_hidden());
+    } else if (key == GLFW_KEY_V && action == GLFW_RELEASE && g_menger) {
+        g_menger->set_weld_vertices(!g_menger->weld_vertices());
+    } else if (key == GLFW_KEY_I && action == GLFW_RELEASE && g_menger) {
+        g_instanced_menger = !g_instanced_menger;
+        g_menger->set_dirty();
+    } else if (key == GLFW_KEY_G && mods == GLFW_MOD_CONTROL && action == GLFW_RELEASE) {
+        g_render_cells = !g_render_cells;
+    } else if (key == GLFW_KEY_G && action == GLFW_RELEASE && g_menger) {
+        g_menger->set_merge_faces(!g_menger->merge_faces());
+    } else if (key == GLFW_KEY_K && action == GLFW_RELEASE) {
+        g_cull_clusters = !g_cull_clusters;
+        std::cout << "menger cluster culling " << (g_cull_clusters ? "on" : "off") << std::endl;
     }
-	if (!g_menger) return; // 0-4 only available in Menger mode.
+	if (!g_menger) return; // 0-7 only available in Menger mode.
 	if (key == GLFW_KEY_0 && action != GLFW_RELEASE) {
 		g_menger->set_nesting_level(0);
 	} else if (key == GLFW_KEY_1 && action != GLFW_RELEASE) {
@@ -291,6 +759,12 @@ void KeyCallback(GLFWwindow* window,
         g_menger->set_nesting_level(3);
 	} else if (key == GLFW_KEY_4 && action != GLFW_RELEASE) {
         g_menger->set_nesting_level(4);
+	} else if (key == GLFW_KEY_5 && action != GLFW_RELEASE) {
+        g_menger->set_nesting_level(5);
+	} else if (key == GLFW_KEY_6 && action != GLFW_RELEASE) {
+        g_menger->set_nesting_level(6);
+	} else if (key == GLFW_KEY_7 && action != GLFW_RELEASE) {
+        g_menger->set_nesting_level(7);
 	}
 }
 
@@ -348,8 +822,22 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
 
 int main(int argc, char* argv[]) {
 
-	if(argc > 1 && argv[1][0] == '-' && argv[1][1] == 's') // TODO: put this in right place?
-		smooth_ctrl = true;
+	for (int i = 1; i < argc; ++i) {
+		if(argv[i][0] == '-' && argv[i][1] == 's') // TODO: put this in right place?
+			smooth_ctrl = true;
+		if(argv[i][0] == '-' && argv[i][1] == 'c') // compact vertex layout
+			g_compact_vertices = true;
+		if(argv[i][0] == '-' && argv[i][1] == 'f') // ocean heightfield, -f or -f256
+			g_ocean_grid_resolution = argv[i][2] ? std::max(1, atoi(argv[i] + 2)) : 128;
+		if(argv[i][0] == '-' && argv[i][1] == 'o') // FFT ocean, -o or -o512
+			g_spectral_resolution = argv[i][2] ? std::max(4, atoi(argv[i] + 2)) : 256;
+		if(argv[i][0] == '-' && argv[i][1] == 'w') // ship wakes
+			g_ship_wakes = true;
+		if(argv[i][0] == '-' && argv[i][1] == 'b') { // benchmarks only, no window
+			bench::run();
+			return 0;
+		}
+	}
 
 	std::string window_title = "Menger";
 	if (!glfwInit()) exit(EXIT_FAILURE);
@@ -364,7 +852,12 @@ int main(int argc, char* argv[]) {
 	std::vector<glm::uvec3> obj_faces;
 	g_menger->set_nesting_level(1);
 	g_menger->generate_geometry(obj_vertices, obj_faces);
-	g_menger->set_clean();
+
+	// instanced menger: one unit cube + a lattice cell per instance
+	std::vector<glm::vec4> cube_vertices;
+	std::vector<glm::uvec3> cube_faces;
+	std::vector<glm::u16vec4> obj_cells;
+	Menger::unit_cube(cube_vertices, cube_faces);
 
 	// floor
 	std::vector<glm::vec4> floor_vertices;
@@ -390,7 +883,8 @@ int main(int argc, char* argv[]) {
     // ships
     std::vector<glm::vec4> ship_vertices;
 	std::vector<glm::uvec3> ship_faces;
-    ship::generate_geometry(ship_vertices, ship_faces);
+	std::vector<glm::vec4> ship_normals;
+    ship::generate_geometry(ship_vertices, ship_faces, ship_normals);
 
 	/*********************************************************/
 	/*** OpenGL: Context  ************************************/
@@ -434,17 +928,35 @@ int main(int argc, char* argv[]) {
     CHECK_GL_ERROR(glGenVertexArrays(kNumVaos, &g_array_objects[0]));
 
 	/*** Geometry Program ***/
-    BASE_VAO_SETUP(Menger, 4, 3, obj);
+	// menger meshes get their VAOs from the level cache
 	/*** Floor Program ***/
     BASE_VAO_SETUP(Floor, 4, 3, floor);
 	/*** Ocean Program ***/
     BASE_VAO_SETUP(Ocean, 4, 4, ocean);
     /*** Light Program ***/
-    BASE_VAO_SETUP(Light, 4, 3, light);
+    PACKED_VAO_SETUP(Light, light);
     /*** Ship Program(s) ***/
-    BASE_VAO_SETUP(Ship, 4, 3, ship);
+    PACKED_VAO_SETUP(Ship, ship);
+    meshopt::remap(ship_normals, ship_remap);
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kShipVao][kNormalBuffer]));
+    if (g_compact_vertices) {
+        std::vector<glm::i16vec2> packed_normals;
+        meshpack::pack_normals(ship_normals, packed_normals);
+        CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::i16vec2) * packed_normals.size(), packed_normals.data(), GL_STATIC_DRAW));
+        CHECK_GL_ERROR(glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, 0, 0));
+    } else {
+        CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * ship_normals.size(), ship_normals.data(), GL_STATIC_DRAW));
+        CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0));
+    }
+    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
     /*** Seabed Program ***/
     BASE_VAO_SETUP(Seabed, 4, 4, seabed);
+	/*** Instanced Geometry Program ***/
+    PACKED_VAO_SETUP(MengerInstanced, cube);
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kMengerInstancedVao][kInstanceBuffer]));
+    CHECK_GL_ERROR(glVertexAttribPointer(1, 4, GL_UNSIGNED_SHORT, GL_FALSE, 0, 0));
+    CHECK_GL_ERROR(glEnableVertexAttribArray(1));
+    CHECK_GL_ERROR(glVertexAttribDivisor(1, 1));
 
 	/*********************************************************/
 	/*** OpenGL: Shaders & Programs **************************/
@@ -475,7 +987,31 @@ int main(int argc, char* argv[]) {
 	GLint render_wireframe_location = 0;
 	CHECK_GL_ERROR(render_wireframe_location =
 		glGetUniformLocation(program_id, "render_wireframe"));
-
+	GLint render_cells_location = 0;
+	CHECK_GL_ERROR(render_cells_location =
+		glGetUniformLocation(program_id, "render_cells"));
+	GLint cell_size_location = 0;
+	CHECK_GL_ERROR(cell_size_location =
+		glGetUniformLocation(program_id, "cell_size"));
+	GLint unpack_location = 0;
+	CHECK_GL_ERROR(unpack_location =
+		glGetUniformLocation(program_id, "unpack"));
+
+
+	/*** Instanced Geometry Program ***/
+
+    std::cout << "Compiling instanced menger program." << std::endl;
+	GLuint menger_instanced_program_id = shaders::menger_instanced_sss.compile().create_program();
+	CHECK_GL_ERROR(glBindAttribLocation(menger_instanced_program_id, 0, "w_pos"));
+	CHECK_GL_ERROR(glBindAttribLocation(menger_instanced_program_id, 1, "cell"));
+	CHECK_GL_ERROR(glBindFragDataLocation(menger_instanced_program_id, 0, "frag_col"));
+	glLinkProgram(menger_instanced_program_id);
+	CHECK_GL_PROGRAM_ERROR(menger_instanced_program_id);
+    GET_UNIFORM_LOC(menger_instanced, projection);
+    GET_UNIFORM_LOC(menger_instanced, view);
+    GET_UNIFORM_LOC(menger_instanced, w_lpos);
+    GET_UNIFORM_LOC(menger_instanced, cell_size);
+    GET_UNIFORM_LOC(menger_instanced, unpack);
 
 	/*** Floor Program ***/
 
@@ -541,7 +1077,19 @@ int main(int argc, char* argv[]) {
 
     GET_UNIFORM_LOC(ocean, wave_time);
     GET_UNIFORM_LOC(ocean, wave_type);
-    GET_UNIFORM_LOC(ocean, tidal_time);
+    GET_UNIFORM_LOC(ocean, spectral);
+    GET_UNIFORM_LOC(ocean, spectral_tile);
+    GET_UNIFORM_LOC(ocean, spectral_size);
+    GET_UNIFORM_LOC(ocean, packets);
+    GET_UNIFORM_LOC(ocean, packet_tile);
+    GET_UNIFORM_LOC(ocean, packet_lo);
+    GET_UNIFORM_LOC(ocean, packet_hi);
+    GET_UNIFORM_LOC(ocean, lod_pixel);
+    GLuint ocean_swell_block = 0;
+    CHECK_GL_ERROR(ocean_swell_block = glGetUniformBlockIndex(ocean_program_id, "swell_block"));
+    if (ocean_swell_block != GL_INVALID_INDEX) {
+        CHECK_GL_ERROR(glUniformBlockBinding(ocean_program_id, ocean_swell_block, 0));
+    }
 
     GET_UNIFORM_LOC(ocean, render_wireframe);
     GET_UNIFORM_LOC(ocean, cterm);
@@ -566,6 +1114,7 @@ int main(int argc, char* argv[]) {
     GET_UNIFORM_LOC(light, projection);
     GET_UNIFORM_LOC(light, view);
     GET_UNIFORM_LOC(light, model);
+    GET_UNIFORM_LOC(light, unpack);
     GET_UNIFORM_LOC(light, w_lpos);
     GET_UNIFORM_LOC(light, render_wireframe);
 
@@ -575,6 +1124,7 @@ int main(int argc, char* argv[]) {
 	GLuint ship_program_id = shaders::ship_sss.compile().create_program();
 	// bind attributes
 	CHECK_GL_ERROR(glBindAttribLocation(ship_program_id, 0, "w_pos"));
+	CHECK_GL_ERROR(glBindAttribLocation(ship_program_id, 1, "normal"));
 	CHECK_GL_ERROR(glBindFragDataLocation(ship_program_id, 0, "frag_col"));
 	glLinkProgram(ship_program_id);
 	CHECK_GL_PROGRAM_ERROR(ship_program_id);
@@ -582,6 +1132,8 @@ int main(int argc, char* argv[]) {
     GET_UNIFORM_LOC(ship, projection);
     GET_UNIFORM_LOC(ship, view);
     GET_UNIFORM_LOC(ship, model);
+    GET_UNIFORM_LOC(ship, unpack);
+    GET_UNIFORM_LOC(ship, packed_normals);
     GET_UNIFORM_LOC(ship, w_lpos);
     GET_UNIFORM_LOC(ship, render_wireframe);
     GET_UNIFORM_LOC(ship, cterm);
@@ -612,7 +1164,18 @@ int main(int argc, char* argv[]) {
     GET_UNIFORM_LOC(seabed, tcs_out_deg);
     GET_UNIFORM_LOC(seabed, wave_time);
     GET_UNIFORM_LOC(seabed, wave_type);
-    GET_UNIFORM_LOC(seabed, tidal_time);
+    GET_UNIFORM_LOC(seabed, spectral);
+    GET_UNIFORM_LOC(seabed, spectral_tile);
+    GET_UNIFORM_LOC(seabed, spectral_size);
+    GET_UNIFORM_LOC(seabed, packets);
+    GET_UNIFORM_LOC(seabed, packet_tile);
+    GET_UNIFORM_LOC(seabed, packet_lo);
+    GET_UNIFORM_LOC(seabed, packet_hi);
+    GLuint seabed_swell_block = 0;
+    CHECK_GL_ERROR(seabed_swell_block = glGetUniformBlockIndex(seabed_program_id, "swell_block"));
+    if (seabed_swell_block != GL_INVALID_INDEX) {
+        CHECK_GL_ERROR(glUniformBlockBinding(seabed_program_id, seabed_swell_block, 0));
+    }
     GET_UNIFORM_LOC(seabed, render_wireframe);
 
     GET_UNIFORM_LOC(seabed, wave_cnt);
@@ -655,25 +1218,21 @@ int main(int argc, char* argv[]) {
 
     //ocean data group
     fluid::ocean_surf_params ocean_data {
-        std::vector<fluid::wave_params> {{}},
-        fluid::gaussian_params {
-            glm::vec2(0.001, 0),
-            glm::vec2(-10, 0),
-            40.0,
-            1.0,
-            -std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::minutes(1)).count()
-        },
+        fluid::wave_pool(),
+        std::vector<fluid::gaussian_params> {},
         std::vector<fluid::wave_packet> {},
         g_storminess
     };
     ocean_data.elapse_time(1);
     double wave_life_avg = 0;
-    for (auto& wave : ocean_data.wpars) {
-        wave_life_avg += wave.life;
+    for (size_t i = 0; i < ocean_data.wpars.size(); ++i) {
+        wave_life_avg += ocean_data.wpars[i].life;
         wave_life_avg /= 2;
     }
-    for (auto& wave : ocean_data.wpars) {
+    for (size_t i = 0; i < ocean_data.wpars.size(); ++i) {
+        fluid::wave_params wave = ocean_data.wpars[i];
         wave.time = wave_life_avg / 2;
+        ocean_data.wpars.replace(i, wave);
     }
 
     // Ship
@@ -708,6 +1267,54 @@ int main(int argc, char* argv[]) {
             glm::vec3(0.0f, 0.0f, -1.0f)
         }
     }};
+    std::vector<glm::mat4> ship_model_matrices;
+    fluid::heightfield ocean_grid(glm::vec2(-20.0f), glm::vec2(20.0f), std::max(1, g_ocean_grid_resolution));
+
+    // FFT ocean, one tile over the 40x40 ocean, on texture unit 0
+    fluid::spectral_params spectral_data;
+    spectral_data.resolution = std::max(4, g_spectral_resolution);
+    spectral_data.tile_size = 40.0f;
+    fluid::spectral_ocean spectral_ocean(spectral_data);
+    GLuint spectral_texture = 0;
+    if (g_spectral_resolution) {
+        const int n = spectral_ocean.params().resolution;
+        CHECK_GL_ERROR(glGenTextures(1, &spectral_texture));
+        CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+        CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, spectral_texture));
+        CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, n, n, 0, GL_RGBA, GL_FLOAT, nullptr));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT));
+        // Mipmapped so far patches read the tile averaged down to their spacing
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    }
+
+    // Swells, shared by every ocean shader through uniform block binding 0
+    GLuint swell_buffer = 0;
+    CHECK_GL_ERROR(glGenBuffers(1, &swell_buffer));
+    CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, swell_buffer));
+    CHECK_GL_ERROR(glBufferData(GL_UNIFORM_BUFFER, sizeof(fluid::swell_block), nullptr, GL_DYNAMIC_DRAW));
+    CHECK_GL_ERROR(glBindBufferBase(GL_UNIFORM_BUFFER, 0, swell_buffer));
+    int swells_launched = 0;
+
+    // Wave packets over the ocean, rasterized onto texture unit 1
+    const glm::vec2 packet_lo(-20.0f), packet_hi(20.0f);
+    const int packet_resolution = 256;
+    fluid::packet_field packet_field(packet_lo, packet_hi);
+    std::vector<glm::vec4> packet_tile;
+    double last_wake = 0;
+    GLuint packet_texture = 0;
+    if (g_ship_wakes) {
+        CHECK_GL_ERROR(glGenTextures(1, &packet_texture));
+        CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE1));
+        CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, packet_texture));
+        CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, packet_resolution, packet_resolution, 0,
+            GL_RGBA, GL_FLOAT, nullptr));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+        CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    }
 
 	while (!glfwWindowShouldClose(window)) {
 
@@ -717,8 +1324,57 @@ int main(int argc, char* argv[]) {
 		auto ct = std::chrono::system_clock::now();
         double elapsed = (ct - g_lt).count();
         double since_start = std::chrono::duration_cast<std::chrono::milliseconds>(ct - start).count();
-        double tidal_since_start = (since_start - ocean_data.gp.start) / 1000.0;
+        // The shaders take the first 20 waves (waves[20]); the pool can hold more
+        const size_t shader_wave_cnt = std::min<size_t>(ocean_data.wpars.size(), 20);
         g_lt = ct;
+        ocean_data.retire_swells(since_start);
+        const fluid::swell_block swells = fluid::make_swell_block(since_start, ocean_data);
+        CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, swell_buffer));
+        CHECK_GL_ERROR(glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(swells), &swells));
+        if (g_ocean_grid_resolution) ocean_grid.update(since_start, ocean_data);
+        if (g_spectral_resolution) {
+            // Storminess picks the wind; a rebuild only happens when it changes
+            spectral_data.wind_speed = 4.0f + ocean_data.storminess;
+            spectral_data.wave_height = 1.0f + 0.5f * ocean_data.storminess;
+            spectral_ocean.set_params(spectral_data);
+            spectral_ocean.update(since_start / 1000.0);
+            const int n = spectral_ocean.params().resolution;
+            CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+            CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, spectral_texture));
+            CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, n, GL_RGBA, GL_FLOAT,
+                spectral_ocean.tile().data()));
+            CHECK_GL_ERROR(glGenerateMipmap(GL_TEXTURE_2D));
+        }
+        if (g_ship_wakes) {
+            // Every 250 ms each ship sends a packet off either side of its
+            // stern, about 35 degrees out, as in a Kelvin wake
+            if (g_launch_ships && since_start - last_wake > 250) {
+                last_wake = since_start;
+                for (const auto& instance : ship_instances) {
+                    const glm::vec2 plane_pos(instance.w_pos[0], instance.w_pos[2]);
+                    const glm::vec2 vel(instance.vel[0], instance.vel[2]);
+                    const glm::vec2 back = glm::length(vel) > 0 ? -glm::normalize(vel) : glm::vec2(-1.0f, 0.0f);
+                    for (float side : {-1.0f, 1.0f}) {
+                        const float angle = side * 0.61f;
+                        fluid::wave_packet packet;
+                        packet.start = since_start / 1000.0;
+                        packet.center = plane_pos;
+                        packet.dir = glm::vec2(back.x * std::cos(angle) - back.y * std::sin(angle),
+                            back.x * std::sin(angle) + back.y * std::cos(angle));
+                        packet.wavelength = 1.5f;
+                        packet.amp = 0.15f;
+                        packet.radius = 1.5f;
+                        ocean_data.wpacks.push_back(packet);
+                    }
+                }
+            }
+            packet_field.update(since_start / 1000.0, ocean_data.wpacks);
+            packet_field.rasterize(packet_resolution, packet_tile);
+            CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE1));
+            CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, packet_texture));
+            CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, packet_resolution, packet_resolution,
+                GL_RGBA, GL_FLOAT, packet_tile.data()));
+        }
 
 		/*********************************************************/
 		/*** OpenGL: Clear ***************************************/
@@ -736,16 +1392,24 @@ int main(int argc, char* argv[]) {
 
 		// Switch to the Geometry VAO.
 		if (g_menger && g_menger->is_dirty()) {
-            g_menger->generate_geometry(obj_vertices, obj_faces);
+			ClearMengerChunks();
+		}
+		if (g_menger && g_menger->is_dirty() && g_menger->chunked()) {
+			BuildMengerChunks(*g_menger);
+			g_menger->set_clean();
+		} else if (g_menger && g_menger->is_dirty() && g_instanced_menger) {
+            g_menger->generate_instances(obj_cells);
 			g_menger->set_clean();
 
-            CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kMengerVao]));
-
-            CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kMengerVao][kVertexBuffer]));
-            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * obj_vertices.size() * 4, obj_vertices.data(), GL_STATIC_DRAW));
-
-            CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_buffer_objects[kMengerVao][kIndexBuffer]));
-            CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * obj_faces.size() * 3, obj_faces.data(), GL_STATIC_DRAW));
+            CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, g_buffer_objects[kMengerInstancedVao][kInstanceBuffer]));
+            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, sizeof(glm::u16vec4) * obj_cells.size(), obj_cells.data(), GL_STATIC_DRAW));
+            std::cout << "menger level " << g_menger->nesting_level() << ": "
+                << obj_cells.size() << " instances, "
+                << sizeof(glm::u16vec4) * obj_cells.size() + (sizeof(glm::vec4) * cube_vertices.size() + sizeof(glm::uvec3) * cube_faces.size())
+                << " bytes on the GPU" << std::endl;
+		} else if (g_menger && !g_menger->chunked() && !g_instanced_menger) {
+			UpdateMengerMesh(*g_menger, g_menger->is_dirty());
+			g_menger->set_clean();
 		}
 
 		/*********************************************************/
@@ -757,6 +1421,13 @@ int main(int argc, char* argv[]) {
 			glm::perspectiveFov(g_camera.get_fov(45.0f), (float) window_width, (float) window_height, 0.0001f, 1000.0f);
 		// Compute the view matrix
 		glm::mat4 view_matrix = g_camera.get_view_matrix();
+		// Back faces only hide behind front faces when filled
+		MengerView menger_view {meshlet::extract_frustum(projection_matrix * view_matrix),
+			glm::vec3(glm::inverse(view_matrix)[3]), g_render_base};
+		const MengerView* menger_cull = g_cull_clusters ? &menger_view : nullptr;
+		// World units a pixel covers per unit of distance
+		const float lod_pixel = 2 * std::tan(g_camera.get_fov(45.0f) / 2) / window_height;
+		const glm::mat4 menger_unpack = MengerUnpack();
 
 		/**************************************and()*******************/
 		/*** OpenGL: Render  *************************************/
@@ -764,21 +1435,45 @@ int main(int argc, char* argv[]) {
         /** Universal settings ***/
         glPolygonMode(GL_FRONT_AND_BACK, g_render_base ? GL_FILL : GL_LINE);
 
-        if (!enable_ocean || g_show_menger) {
+        if ((!enable_ocean || g_show_menger) && g_menger->chunked()) {
+        	/*** Instanced Menger Program, one instanced draw per sponge level ***/
+        	CHECK_GL_ERROR(glUseProgram(menger_instanced_program_id));
+        	CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(menger_instanced, projection), 1, GL_FALSE, &projection_matrix[0][0]));
+        	CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(menger_instanced, view), 1, GL_FALSE, &view_matrix[0][0]));
+        	CHECK_GL_ERROR(glUniform4fv(ULNAME(menger_instanced, w_lpos), 1, &light_position[0]));
+        	CHECK_GL_ERROR(glUniform1f(ULNAME(menger_instanced, cell_size), g_menger_chunks.chunk_size));
+        	CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(menger_instanced, unpack), 1, GL_FALSE, &menger_unpack[0][0]));
+            DrawMengerChunks(menger_view, menger_cull, lod_pixel);
+        } else if ((!enable_ocean || g_show_menger) && g_instanced_menger) {
+        	/*** Instanced Menger Program ***/
+        	CHECK_GL_ERROR(glUseProgram(menger_instanced_program_id));
+            CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kMengerInstancedVao]));
+
+        	CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(menger_instanced, projection), 1, GL_FALSE, &projection_matrix[0][0]));
+        	CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(menger_instanced, view), 1, GL_FALSE, &view_matrix[0][0]));
+        	CHECK_GL_ERROR(glUniform4fv(ULNAME(menger_instanced, w_lpos), 1, &light_position[0]));
+        	CHECK_GL_ERROR(glUniform1f(ULNAME(menger_instanced, cell_size), g_menger->cell_size()));
+        	CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(menger_instanced, unpack), 1, GL_FALSE, &g_unpack[kMengerInstancedVao][0][0]));
+
+            // draw every cube in one call
+        	CHECK_GL_ERROR(glDrawElementsInstanced(GL_TRIANGLES, cube_faces.size() * 3, g_index_types[kMengerInstancedVao], 0, obj_cells.size()));
+        } else if (!enable_ocean || g_show_menger) {
         	/*** Menger Program ***/
         	// Use our program.
         	CHECK_GL_ERROR(glUseProgram(program_id));
-        	// Draw our triangles.
-            CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kMengerVao]));
-
         	// Pass uniforms in.
         	CHECK_GL_ERROR(glUniformMatrix4fv(projection_matrix_location, 1, GL_FALSE, &projection_matrix[0][0]));
         	CHECK_GL_ERROR(glUniformMatrix4fv(view_matrix_location, 1, GL_FALSE, &view_matrix[0][0]));
         	CHECK_GL_ERROR(glUniform4fv(light_position_location, 1, &light_position[0]));
             CHECK_GL_ERROR(glUniform1i(render_wireframe_location, g_render_wireframe));
+            CHECK_GL_ERROR(glUniform1i(render_cells_location, g_render_cells));
+            CHECK_GL_ERROR(glUniform1f(cell_size_location, g_menger->cell_size()));
+            CHECK_GL_ERROR(glUniformMatrix4fv(unpack_location, 1, GL_FALSE, &menger_unpack[0][0]));
 
-            // draw
-        	CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, obj_faces.size() * 3, GL_UNSIGNED_INT, 0));
+            // draw, once the first level has finished building
+            if (g_menger_mesh) {
+                DrawMengerMesh(*g_menger_mesh, menger_cull);
+            }
         }
 
 		if(!enable_ocean) {
@@ -818,15 +1513,22 @@ int main(int argc, char* argv[]) {
                 CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, render_wireframe), g_render_wireframe));
                 CHECK_GL_ERROR(glUniform1f(ULNAME(seabed, wave_time), since_start));
                 CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, wave_type), g_wave_type));
-                CHECK_GL_ERROR(glUniform1f(ULNAME(seabed, tidal_time), tidal_since_start));
-                CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, wave_cnt), ocean_data.wpars.size()));
-                for (size_t i = 0; i < ocean_data.wpars.size(); ++i) {
-                    float cal = ocean_data.wpars[i].time / ocean_data.wpars[i].life;
-                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][0], ocean_data.wpars[i].a * ((1 - cal) * cal)));
-                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][1], ocean_data.wpars[i].l));
-                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][2], ocean_data.wpars[i].s));
-                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][3], ocean_data.wpars[i].k));
-                    CHECK_GL_ERROR(glUniform2fv(seabed_waves_locations[i][4], 1, &ocean_data.wpars[i].dir[0]));
+                CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, spectral), g_spectral_resolution != 0));
+                CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, spectral_tile), 0));
+                CHECK_GL_ERROR(glUniform1f(ULNAME(seabed, spectral_size), spectral_data.tile_size));
+                CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, packets), g_ship_wakes));
+                CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, packet_tile), 1));
+                CHECK_GL_ERROR(glUniform2fv(ULNAME(seabed, packet_lo), 1, &packet_lo[0]));
+                CHECK_GL_ERROR(glUniform2fv(ULNAME(seabed, packet_hi), 1, &packet_hi[0]));
+                CHECK_GL_ERROR(glUniform1i(ULNAME(seabed, wave_cnt), shader_wave_cnt));
+                for (size_t i = 0; i < shader_wave_cnt; ++i) {
+                    const fluid::wave_params wave = ocean_data.wpars[i];
+                    float cal = wave.time / wave.life;
+                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][0], wave.a * ((1 - cal) * cal)));
+                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][1], wave.l));
+                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][2], wave.s));
+                    CHECK_GL_ERROR(glUniform1f(seabed_waves_locations[i][3], wave.k));
+                    CHECK_GL_ERROR(glUniform2fv(seabed_waves_locations[i][4], 1, &wave.dir[0]));
                 }
     			// Render floor
     			CHECK_GL_ERROR(glPatchParameteri(GL_PATCH_VERTICES, 4));
@@ -837,11 +1539,19 @@ int main(int argc, char* argv[]) {
                 // set program + vao
                 CHECK_GL_ERROR(glUseProgram(ship_program_id));
                 CHECK_GL_ERROR(glBindVertexArray(g_array_objects[kShipVao]));
-                for (auto& instance : ship_instances) {
-                    auto ship_model_matrix = ship::model_matrix(since_start, instance, ocean_data);
+                if (g_spectral_resolution) {
+                    ship::model_matrices(ship_instances, spectral_ocean, ship_model_matrices);
+                } else if (g_ocean_grid_resolution) {
+                    ship::model_matrices(ship_instances, ocean_grid, ship_model_matrices);
+                } else {
+                    ship::model_matrices(since_start, ship_instances, ocean_data, ship_model_matrices);
+                }
+                for (const auto& ship_model_matrix : ship_model_matrices) {
                     CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(ship, projection), 1, GL_FALSE, &projection_matrix[0][0]));
                     CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(ship, view), 1, GL_FALSE, &view_matrix[0][0]));
                     CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(ship, model), 1, GL_FALSE, &ship_model_matrix[0][0]));
+                    CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(ship, unpack), 1, GL_FALSE, &g_unpack[kShipVao][0][0]));
+                    CHECK_GL_ERROR(glUniform1i(ULNAME(ship, packed_normals), g_compact_vertices));
                     CHECK_GL_ERROR(glUniform4fv(ULNAME(ship, w_lpos), 1, &light_position[0]));
                     CHECK_GL_ERROR(glUniform1i(ULNAME(ship, render_wireframe), g_render_wireframe));
                     CHECK_GL_ERROR(glUniform1f(ULNAME(ship, cterm), cterm));
@@ -852,7 +1562,7 @@ int main(int argc, char* argv[]) {
                     CHECK_GL_ERROR(glUniform3fv(ULNAME(ship, ks), 1, &ship_ks[0]));
                     CHECK_GL_ERROR(glUniform1f(ULNAME(ship, alpha), ship_alpha));
                     CHECK_GL_ERROR(glUniform1f(ULNAME(ship, transparency), 1.0f));
-                    CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, ship_faces.size() * 3, GL_UNSIGNED_INT, 0));
+                    CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, ship_faces.size() * 3, g_index_types[kShipVao], 0));
                 }
             }
 
@@ -867,19 +1577,27 @@ int main(int argc, char* argv[]) {
 			CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, tcs_in_deg), tcs_in_deg));
 			CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, tcs_out_deg), tcs_out_deg));
 
-            CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, wave_cnt), ocean_data.wpars.size()));
-            for (size_t i = 0; i < ocean_data.wpars.size(); ++i) {
-                float cal = ocean_data.wpars[i].time / ocean_data.wpars[i].life;
-                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][0], ocean_data.wpars[i].a * ((1 - cal) * cal)));
-                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][1], ocean_data.wpars[i].l));
-                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][2], ocean_data.wpars[i].s));
-                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][3], ocean_data.wpars[i].k));
-                CHECK_GL_ERROR(glUniform2fv(ocean_waves_locations[i][4], 1, &ocean_data.wpars[i].dir[0]));
+            CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, wave_cnt), shader_wave_cnt));
+            for (size_t i = 0; i < shader_wave_cnt; ++i) {
+                const fluid::wave_params wave = ocean_data.wpars[i];
+                float cal = wave.time / wave.life;
+                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][0], wave.a * ((1 - cal) * cal)));
+                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][1], wave.l));
+                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][2], wave.s));
+                CHECK_GL_ERROR(glUniform1f(ocean_waves_locations[i][3], wave.k));
+                CHECK_GL_ERROR(glUniform2fv(ocean_waves_locations[i][4], 1, &wave.dir[0]));
             }
 
             CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, wave_time), since_start));
             CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, wave_type), g_wave_type));
-            CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, tidal_time), tidal_since_start));
+            CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, spectral), g_spectral_resolution != 0));
+            CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, spectral_tile), 0));
+            CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, spectral_size), spectral_data.tile_size));
+            CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, packets), g_ship_wakes));
+            CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, packet_tile), 1));
+            CHECK_GL_ERROR(glUniform2fv(ULNAME(ocean, packet_lo), 1, &packet_lo[0]));
+            CHECK_GL_ERROR(glUniform2fv(ULNAME(ocean, packet_hi), 1, &packet_hi[0]));
+            CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, lod_pixel), lod_pixel));
             CHECK_GL_ERROR(glUniform1i(ULNAME(ocean, render_wireframe), g_render_wireframe));
             CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, cterm), cterm));
             CHECK_GL_ERROR(glUniform1f(ULNAME(ocean, lterm), lterm));
@@ -900,9 +1618,10 @@ int main(int argc, char* argv[]) {
 			CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(light, projection), 1, GL_FALSE, &projection_matrix[0][0]));
 			CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(light, view), 1, GL_FALSE, &view_matrix[0][0]));
             CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(light, model), 1, GL_FALSE, &light_model_matrix[0][0]));
+            CHECK_GL_ERROR(glUniformMatrix4fv(ULNAME(light, unpack), 1, GL_FALSE, &g_unpack[kLightVao][0][0]));
             CHECK_GL_ERROR(glUniform4fv(ULNAME(light, w_lpos), 1, &light_position[0]));
             CHECK_GL_ERROR(glUniform1i(ULNAME(light, render_wireframe), g_render_wireframe));
-    		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, light_faces.size() * 3, GL_UNSIGNED_INT, 0));
+    		CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, light_faces.size() * 3, g_index_types[kLightVao], 0));
         }
 
 		/*********************************************************/
@@ -929,7 +1648,17 @@ int main(int argc, char* argv[]) {
 
 		if(tidal_reset) { // tidal wave
 			tidal_reset = false;
-            ocean_data.gp.start = since_start;
+            // From the middle at 1 unit/s for 100 s, each 137.5 degrees
+            // round from the last so that they cross
+            const float angle = 2.3999632f * swells_launched++;
+            ocean_data.swells.push_back(fluid::gaussian_params {
+                glm::vec2(std::cos(angle), std::sin(angle)) * 0.001f,
+                glm::vec2(0.0f),
+                5.0f,
+                1.0f,
+                since_start,
+                100000.0
+            });
 		}
 
         if (g_dynamic_waves) ocean_data.elapse_time(elapsed);
@@ -1,11 +1,27 @@
 #include "menger.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <iostream>
+#include <unordered_map>
 #include <glm/gtx/string_cast.hpp>
 
 namespace {
 	const int kMinLevel = 0;
-	const int kMaxLevel = 4;
+	const int kMaxLevel = 7;
+	// Deepest level still generated as a single mesh
+	const int kMaxMeshLevel = 4;
+	// Levels per chunk below kMaxMeshLevel: 8000 cubes, which keeps even
+	// unwelded chunks (64000 vertices) within 16-bit indices
+	const int kChunkDepth = 3;
+	// Smallest cube, in pixels, chunk_lod still draws
+	const float kLodPixels = 2.0f;
+	// Bump whenever generate_geometry's output or the cached meshes change,
+	// so stale mesh cache files are rebuilt (2: cached levels are stored
+	// cache optimized, 3: and grouped by facing for cluster culling, 4: merged
+	// faces split at T-junctions, 5: and cut into n - 2 triangles)
+	const uint32_t kGeneratorVersion = 5;
 };
 
 static const std::vector<glm::vec4> bc_ps = std::vector<glm::vec4>({
@@ -58,6 +74,170 @@ static const std::vector<glm::vec3> shifts = std::vector<glm::vec3>({
     glm::vec3(2, 2, 2)
 });
 
+// Flat copies of bc_ps (moved onto the 0/1 lattice) and bc_fs for the
+// iterative generator; plain arrays keep its inner loops free of indirection.
+static const float bc_corners[8][3] = {
+    {1, 1, 1}, {1, 0, 1}, {0, 0, 1}, {0, 1, 1},
+    {0, 1, 0}, {0, 0, 0}, {1, 0, 0}, {1, 1, 0}
+};
+static const unsigned int bc_indices[12][3] = {
+    {0, 2, 1}, {0, 3, 2}, {3, 4, 5}, {3, 5, 2}, {4, 7, 6}, {4, 6, 5},
+    {7, 1, 6}, {7, 0, 1}, {7, 4, 0}, {3, 0, 4}, {1, 2, 6}, {5, 6, 2}
+};
+// Offset of each shift's sub box on the lattice one level down
+static const std::vector<glm::uvec3> shift_cells = []() {
+    std::vector<glm::uvec3> cells;
+    for (const auto& shift : shifts) {
+        cells.push_back(glm::uvec3(2) - glm::uvec3(shift));
+    }
+    return cells;
+}();
+
+// Number of cells along one edge of the lattice at `level`
+static unsigned int lattice_side(int level) {
+    unsigned int side = 1;
+    for (int i = 0; i < level; ++i) {
+        side *= 3;
+    }
+    return side;
+}
+
+// Lattice coordinates of the minimum corner of cube `index`. The most
+// significant base-20 digit picks the top level shift, matching the block
+// order gen_sub_box lays the cubes out in.
+static glm::uvec3 cell_origin(size_t index, int level) {
+    glm::uvec3 origin(0);
+    unsigned int stride = 1;
+    for (int i = 0; i < level; ++i) {
+        origin += shift_cells[index % shift_cells.size()] * stride;
+        index /= shift_cells.size();
+        stride *= 3;
+    }
+    return origin;
+}
+
+// Cubes come in runs of 20 siblings sharing a parent, so only the parent
+// origin needs decoding from the index.
+static size_t sibling_count(int level) {
+    return level > 0 ? shift_cells.size() : 1;
+}
+static size_t parent_count(int level) {
+    return Menger::cube_count(level) / sibling_count(level);
+}
+
+// Calls fn(index, origin) for every child of `parent`, in generation order
+template <typename Fn>
+static void for_each_sibling(int level, size_t parent, Fn fn) {
+    const size_t siblings = sibling_count(level);
+    const glm::uvec3 parent_origin = cell_origin(parent, level - 1) * 3u;
+    for (size_t s = 0; s < siblings; ++s) {
+        fn(parent * siblings + s, parent_origin + (siblings > 1 ? shift_cells[s] : glm::uvec3(0)));
+    }
+}
+
+// Calls fn(index, origin) for every cube in generation order
+template <typename Fn>
+static void for_each_cube(int level, Fn fn) {
+    for (size_t parent = 0; parent < parent_count(level); ++parent) {
+        for_each_sibling(level, parent, fn);
+    }
+}
+
+// A cell is carved out when, at any depth, two or more of its base-3 digits
+// are the middle one. Cells off the lattice count as empty.
+static bool cell_filled(glm::ivec3 cell, int level) {
+    const int side = lattice_side(level);
+    for (int i = 0; i < 3; ++i) {
+        if (cell[i] < 0 || cell[i] >= side) return false;
+    }
+    for (int i = 0; i < level; ++i) {
+        int middles = (cell[0] % 3 == 1) + (cell[1] % 3 == 1) + (cell[2] % 3 == 1);
+        if (middles >= 2) return false;
+        cell /= 3;
+    }
+    return true;
+}
+
+// Outward neighbour of each side of the cube. Side i is drawn by triangles
+// 2 * i and 2 * i + 1 of bc_indices.
+static const int bc_sides[6][3] = {
+    {0, 0, 1}, {-1, 0, 0}, {0, 0, -1}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0}
+};
+
+// Bit i set when side i of the cube at `origin` is not pressed against
+// another cube
+static unsigned int visible_sides(glm::uvec3 origin, int level) {
+    unsigned int sides = 0;
+    for (int i = 0; i < 6; ++i) {
+        glm::ivec3 neighbour = glm::ivec3(origin) + glm::ivec3(bc_sides[i][0], bc_sides[i][1], bc_sides[i][2]);
+        if (!cell_filled(neighbour, level)) {
+            sides |= 1u << i;
+        }
+    }
+    return sides;
+}
+
+static unsigned int side_count(unsigned int sides) {
+    unsigned int count = 0;
+    for (; sides; sides &= sides - 1) {
+        ++count;
+    }
+    return count;
+}
+
+// Every coordinate of a cube's corners is one of two values, worked out once
+// per cube
+static glm::vec4* emit_cube_vertices(glm::vec4* ov, glm::uvec3 cell, float inv_side) {
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; ++k) {
+        lo[k] = float(cell[k]) * inv_side - 0.5f;
+        hi[k] = (float(cell[k]) + 1.0f) * inv_side - 0.5f;
+    }
+    for (const auto& corner : bc_corners) {
+        glm::vec4& v = *ov++;
+        v[0] = corner[0] != 0.0f ? hi[0] : lo[0];
+        v[1] = corner[1] != 0.0f ? hi[1] : lo[1];
+        v[2] = corner[2] != 0.0f ? hi[2] : lo[2];
+        v[3] = 1.0f;
+    }
+    return ov;
+}
+
+// Writes the triangles of every side set in `sides`, offset by `first`
+template <typename Face>
+static Face* emit_cube_faces(Face* of, unsigned int first, unsigned int sides) {
+    if (sides == 0x3f) {
+        // The common whole cube, without a test per triangle
+        for (int i = 0; i < 12; ++i) {
+            Face& f = *of++;
+            f[0] = bc_indices[i][0] + first;
+            f[1] = bc_indices[i][1] + first;
+            f[2] = bc_indices[i][2] + first;
+        }
+        return of;
+    }
+    for (int i = 0; i < 12; ++i) {
+        if (sides & (1u << (i / 2))) {
+            Face& f = *of++;
+            f[0] = bc_indices[i][0] + first;
+            f[1] = bc_indices[i][1] + first;
+            f[2] = bc_indices[i][2] + first;
+        }
+    }
+    return of;
+}
+
+// Whether b lies on the line through a and c
+static bool collinear(glm::ivec3 a, glm::ivec3 b, glm::ivec3 c) {
+    const glm::ivec3 d = b - a, e = c - b;
+    return d[1] * e[2] == d[2] * e[1] && d[2] * e[0] == d[0] * e[2] && d[0] * e[1] == d[1] * e[0];
+}
+
+// Packs a lattice point into a single hash key, 21 bits per axis
+static uint64_t lattice_key(glm::uvec3 point) {
+    return uint64_t(point[0]) | (uint64_t(point[1]) << 21) | (uint64_t(point[2]) << 42);
+}
+
 Menger::Menger() {
 	// Add additional initialization if you like
 }
@@ -65,12 +245,17 @@ Menger::Menger() {
 Menger::~Menger() {}
 
 void Menger::set_nesting_level(int level) {
-    if (nesting_level_ != level + 1) {
-    	nesting_level_ = level + 1;
+    level = glm::clamp(level, kMinLevel, kMaxLevel);
+    if (nesting_level_ != level) {
+    	nesting_level_ = level;
     	dirty_ = true;
     }
 }
 
+int Menger::nesting_level() const {
+	return nesting_level_;
+}
+
 bool Menger::is_dirty() const {
 	return dirty_;
 }
@@ -79,10 +264,533 @@ void Menger::set_clean() {
 	dirty_ = false;
 }
 
-// FIXME generate Menger sponge geometry
+void Menger::set_dirty() {
+	dirty_ = true;
+}
+
+size_t Menger::cube_count(int level) {
+    size_t count = 1;
+    for (int i = 0; i < level; ++i) {
+        count *= shifts.size();
+    }
+    return count;
+}
+
+void Menger::set_cull_hidden(bool cull) {
+    if (cull_hidden_ != cull) {
+        cull_hidden_ = cull;
+        dirty_ = true;
+    }
+}
+
+bool Menger::cull_hidden() const {
+	return cull_hidden_;
+}
+
+void Menger::set_weld_vertices(bool weld) {
+    if (weld_vertices_ != weld) {
+        weld_vertices_ = weld;
+        dirty_ = true;
+    }
+}
+
+bool Menger::weld_vertices() const {
+	return weld_vertices_;
+}
+
+void Menger::set_merge_faces(bool merge) {
+    if (merge_faces_ != merge) {
+        merge_faces_ = merge;
+        dirty_ = true;
+    }
+}
+
+bool Menger::merge_faces() const {
+	return merge_faces_;
+}
+
+void Menger::set_parallel(bool parallel) {
+    parallel_ = parallel;
+}
+
 void Menger::generate_geometry(
 	std::vector<glm::vec4>& obj_vertices,
 	std::vector<glm::uvec3>& obj_faces
+) const {
+    if (merge_faces_) {
+        gen_merged(obj_vertices, obj_faces);
+    } else {
+        gen_range(0, parent_count(nesting_level_), obj_vertices, obj_faces);
+    }
+}
+
+std::string Menger::cache_name() const {
+    // e.g. menger-4 or menger-4cw
+    return "menger-" + std::to_string(nesting_level_) + (cull_hidden_ ? "c" : "")
+        + (weld_vertices_ ? "w" : "") + (merge_faces_ ? "m" : "");
+}
+
+uint64_t Menger::cache_params() const {
+    const uint32_t params[] = {kGeneratorVersion, uint32_t(nesting_level_), cull_hidden_, weld_vertices_, merge_faces_};
+    return meshcache::hash(params, sizeof(params));
+}
+
+meshcache::mapped_mesh Menger::map_cached() const {
+    return meshcache::mapped_mesh(cache_name(), cache_params());
+}
+
+bool Menger::save_cached(
+	const std::vector<glm::vec4>& obj_vertices,
+	const std::vector<glm::uvec3>& obj_faces
+) const {
+    return meshcache::save(cache_name(), cache_params(), obj_vertices, obj_faces);
+}
+
+bool Menger::chunked() const {
+	return nesting_level_ > kMaxMeshLevel;
+}
+
+size_t Menger::chunk_count() const {
+    return chunked() ? cube_count(nesting_level_ - kChunkDepth) : 1;
+}
+
+// A chunk is the subtree under one cube kChunkDepth levels up. Culling still
+// looks at the whole sponge, so chunk borders never leave holes.
+void Menger::generate_chunk(
+	size_t chunk,
+	std::vector<glm::vec4>& obj_vertices,
+	std::vector<glm::u16vec3>& obj_faces
+) const {
+    const size_t parents = chunked() ? parent_count(kChunkDepth) : parent_count(nesting_level_);
+    gen_range(chunk * parents, (chunk + 1) * parents, obj_vertices, obj_faces);
+}
+
+void Menger::generate_chunk_cells(std::vector<glm::u16vec4>& obj_cells) const {
+    // Every chunk, even one with all six neighbours: its tunnels line up
+    // with theirs and can be seen down from outside
+    Menger parents = *this;
+    parents.set_nesting_level(chunked() ? nesting_level_ - kChunkDepth : 0);
+    parents.set_cull_hidden(false);
+    parents.generate_instances(obj_cells);
+}
+
+float Menger::chunk_size() const {
+    return chunked() ? 1.0f / lattice_side(nesting_level_ - kChunkDepth) : 1.0f;
+}
+
+int Menger::chunk_depth() {
+    return kChunkDepth;
+}
+
+int Menger::chunk_lod(float pixels) {
+    int level = 0;
+    while (level < kChunkDepth && pixels / 3 >= kLodPixels) {
+        pixels /= 3;
+        ++level;
+    }
+    return level;
+}
+
+template <typename Face>
+void Menger::gen_range(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const {
+    if (weld_vertices_) {
+        gen_welded(begin, end, ov, of);
+    } else if (cull_hidden_) {
+        gen_visible(begin, end, ov, of);
+    } else {
+        gen_cubes(begin, end, ov, of);
+    }
+}
+
+// Every cube is placed independently from its index, so the buffers are sized
+// once and written in place. Parents write disjoint ranges and are shared out
+// between OpenMP threads.
+template <typename Face>
+void Menger::gen_cubes(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const {
+    const int level = nesting_level_;
+    const float inv_side = 1.0f / lattice_side(level);
+    const size_t first = begin * sibling_count(level);
+    const size_t cubes = (end - begin) * sibling_count(level);
+    ov.resize(cubes * 8);
+    of.resize(cubes * 12);
+
+    glm::vec4* vertices = ov.data();
+    Face* faces = of.data();
+    const long parents = end - begin;
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        for_each_sibling(level, begin + parent, [&](size_t i, glm::uvec3 origin) {
+            emit_cube_vertices(vertices + (i - first) * 8, origin, inv_side);
+            emit_cube_faces(faces + (i - first) * 12, (i - first) * 8, 0x3f);
+        });
+    }
+}
+
+// Drops the sides shared by two neighbouring cubes, along with cubes that
+// have no side left. A counting pass sizes the buffers and gives every parent
+// its output offsets, so both passes run in parallel and the result does not
+// depend on the thread count.
+template <typename Face>
+void Menger::gen_visible(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const {
+    const int level = nesting_level_;
+    const float inv_side = 1.0f / lattice_side(level);
+    const long parents = end - begin;
+    // {cubes, faces} emitted before each parent, filled with counts first
+    std::vector<glm::uvec2> offsets(parents + 1);
+
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        glm::uvec2 count(0);
+        for_each_sibling(level, begin + parent, [&](size_t, glm::uvec3 origin) {
+            unsigned int sides = side_count(visible_sides(origin, level));
+            count += glm::uvec2(sides > 0, sides * 2);
+        });
+        offsets[parent + 1] = count;
+    }
+    for (long parent = 0; parent < parents; ++parent) {
+        offsets[parent + 1] += offsets[parent];
+    }
+    ov.resize(offsets[parents][0] * 8);
+    of.resize(offsets[parents][1]);
+
+    glm::vec4* vertices = ov.data();
+    Face* faces = of.data();
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        glm::vec4* vp = vertices + offsets[parent][0] * 8;
+        Face* fp = faces + offsets[parent][1];
+        for_each_sibling(level, begin + parent, [&](size_t, glm::uvec3 origin) {
+            unsigned int sides = visible_sides(origin, level);
+            if (sides) {
+                fp = emit_cube_faces(fp, vp - vertices, sides);
+                vp = emit_cube_vertices(vp, origin, inv_side);
+            }
+        });
+    }
+}
+
+// Emits every lattice point once, so faces of neighbouring cubes index
+// shared vertices. Honours cull_hidden_. A point belongs to the first parent
+// with a drawn cube touching it, found as a parallel minimum over a dense
+// array of the lattice points in range, and is numbered in the order that
+// parent first touches it. Counting, like gen_visible, then gives every
+// parent its output offsets, so all passes run in parallel and the numbering
+// is the serial first-seen order whatever the thread count.
+template <typename Face>
+void Menger::gen_welded(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const {
+    const int level = nesting_level_;
+    const float inv_side = 1.0f / lattice_side(level);
+    const long parents = end - begin;
+    auto parent_origin = [&](long parent) {
+        return cell_origin(begin + parent, level - 1) * 3u;
+    };
+
+    // Lattice points touched by the range: every parent's 4x4x4 block
+    glm::uvec3 lo(UINT_MAX), hi(0);
+    for (long parent = 0; parent < parents; ++parent) {
+        lo = glm::min(lo, parent_origin(parent));
+        hi = glm::max(hi, parent_origin(parent));
+    }
+    const glm::uvec3 dims = hi - lo + 4u;
+    auto point_index = [&](glm::uvec3 p) {
+        p -= lo;
+        return (size_t(p[2]) * dims[1] + p[1]) * dims[0] + p[0];
+    };
+    auto corner_point = [](glm::uvec3 origin, int c) {
+        return origin + glm::uvec3(bc_corners[c][0], bc_corners[c][1], bc_corners[c][2]);
+    };
+    // Distance of each corner from the cube's first point in the array
+    size_t corner_step[8];
+    for (int c = 0; c < 8; ++c) {
+        corner_step[c] = point_index(corner_point(lo, c));
+    }
+    std::vector<std::atomic<unsigned int>> owner(size_t(dims[0]) * dims[1] * dims[2]);
+    // Number of each point within its owner, from 1 (0 while unnumbered)
+    std::vector<unsigned char> local(owner.size());
+    // {vertices, faces} emitted before each parent, filled with counts first
+    std::vector<glm::uvec2> offsets(parents + 1);
+    // Drawn sides of every cube, worked out in the first pass
+    const size_t first = begin * sibling_count(level);
+    std::vector<unsigned char> cube_sides(parents * sibling_count(level));
+
+    const long points = owner.size();
+    #pragma omp parallel for if(parallel_ && points > 1) schedule(static)
+    for (long i = 0; i < points; ++i) {
+        owner[i].store(UINT_MAX, std::memory_order_relaxed);
+    }
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        unsigned int faces = 0;
+        for_each_sibling(level, begin + parent, [&](size_t i, glm::uvec3 origin) {
+            const unsigned int sides = cull_hidden_ ? visible_sides(origin, level) : 0x3f;
+            cube_sides[i - first] = sides;
+            if (!sides) return;
+            faces += side_count(sides) * 2;
+            const size_t base = point_index(origin);
+            for (int c = 0; c < 8; ++c) {
+                std::atomic<unsigned int>& o = owner[base + corner_step[c]];
+                unsigned int current = o.load(std::memory_order_relaxed);
+                while (parent < current && !o.compare_exchange_weak(current, parent, std::memory_order_relaxed)) {}
+            }
+        });
+        offsets[parent + 1][1] = faces;
+    }
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        unsigned int vertices = 0;
+        for_each_sibling(level, begin + parent, [&](size_t i, glm::uvec3 origin) {
+            if (!cube_sides[i - first]) return;
+            const size_t base = point_index(origin);
+            for (int c = 0; c < 8; ++c) {
+                const size_t p = base + corner_step[c];
+                // Only this parent writes the points it owns
+                if (owner[p].load(std::memory_order_relaxed) == unsigned(parent) && local[p] == 0) {
+                    local[p] = ++vertices;
+                }
+            }
+        });
+        offsets[parent + 1][0] = vertices;
+    }
+    for (long parent = 0; parent < parents; ++parent) {
+        offsets[parent + 1] += offsets[parent];
+    }
+    ov.resize(offsets[parents][0]);
+    of.resize(offsets[parents][1]);
+
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        Face* fp = of.data() + offsets[parent][1];
+        for_each_sibling(level, begin + parent, [&](size_t i, glm::uvec3 origin) {
+            const unsigned int sides = cube_sides[i - first];
+            if (!sides) return;
+            unsigned int corners[8];
+            const size_t base = point_index(origin);
+            for (int c = 0; c < 8; ++c) {
+                const size_t p = base + corner_step[c];
+                const unsigned int o = owner[p].load(std::memory_order_relaxed);
+                corners[c] = offsets[o][0] + local[p] - 1;
+                if (o == unsigned(parent)) {
+                    ov[corners[c]] = glm::vec4(glm::vec3(corner_point(origin, c)) * inv_side - 0.5f, 1.0f);
+                }
+            }
+            for (int t = 0; t < 12; ++t) {
+                if (sides & (1u << (t / 2))) {
+                    Face& f = *fp++;
+                    f[0] = corners[bc_indices[t][0]];
+                    f[1] = corners[bc_indices[t][1]];
+                    f[2] = corners[bc_indices[t][2]];
+                }
+            }
+        });
+    }
+}
+
+// Greedy meshing: every lattice plane is swept once per axis and facing, the
+// exposed unit squares are collected in a mask, and each is grown first
+// along u, then along v, into the largest rectangle still fully exposed.
+// Each rectangle's outline then picks up every other rectangle's corner lying
+// on its edges, so no edge ends partway along a neighbour's (a T-junction)
+// and the surface stays watertight, and is cut into n - 2 triangles.
+// Honours weld_vertices_.
+void Menger::gen_merged(std::vector<glm::vec4>& ov, std::vector<glm::uvec3>& of) const {
+    const int level = nesting_level_;
+    const int side = lattice_side(level);
+    const float inv_side = 1.0f / side;
+
+    std::vector<unsigned char> filled(size_t(side) * side * side);
+    #pragma omp parallel for if(parallel_ && side > 1) schedule(static)
+    for (int z = 0; z < side; ++z) {
+        for (int y = 0; y < side; ++y) {
+            for (int x = 0; x < side; ++x) {
+                filled[(size_t(z) * side + y) * side + x] = cell_filled(glm::ivec3(x, y, z), level);
+            }
+        }
+    }
+    auto is_filled = [&](glm::ivec3 cell) {
+        for (int i = 0; i < 3; ++i) {
+            if (cell[i] < 0 || cell[i] >= side) return false;
+        }
+        return filled[(size_t(cell[2]) * side + cell[1]) * side + cell[0]] != 0;
+    };
+
+    // A merged rectangle, spanning du and dv from corner
+    struct rect {
+        glm::uvec3 corner, du, dv;
+        bool front;
+    };
+    std::vector<rect> rects;
+    // Whether a lattice point is some rectangle's corner
+    const size_t points = side + 1;
+    std::vector<unsigned char> corners(points * points * points);
+    auto point_index = [&](glm::uvec3 p) {
+        return (p[2] * points + p[1]) * points + p[0];
+    };
+
+    // Unit squares on the surface, two triangles each when culling alone
+    size_t exposed = 0;
+    std::vector<unsigned char> mask(size_t(side) * side);
+    for (int axis = 0; axis < 3; ++axis) {
+        // (u, v, axis) is right handed, so u x v points along +axis
+        const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        for (int facing = 1; facing >= -1; facing -= 2) {
+            for (int d = 0; d < side; ++d) {
+                for (int j = 0; j < side; ++j) {
+                    for (int i = 0; i < side; ++i) {
+                        glm::ivec3 cell;
+                        cell[axis] = d;
+                        cell[u] = i;
+                        cell[v] = j;
+                        glm::ivec3 neighbour = cell;
+                        neighbour[axis] += facing;
+                        mask[j * side + i] = is_filled(cell) && !is_filled(neighbour);
+                        exposed += mask[j * side + i];
+                    }
+                }
+
+                for (int j = 0; j < side; ++j) {
+                    for (int i = 0; i < side; ++i) {
+                        if (!mask[j * side + i]) continue;
+                        int w = 1;
+                        while (i + w < side && mask[j * side + i + w]) ++w;
+                        int h = 1;
+                        for (; j + h < side; ++h) {
+                            int k = 0;
+                            while (k < w && mask[(j + h) * side + i + k]) ++k;
+                            if (k < w) break;
+                        }
+                        for (int y = j; y < j + h; ++y) {
+                            std::fill_n(mask.begin() + y * side + i, w, 0);
+                        }
+
+                        glm::uvec3 corner;
+                        corner[axis] = facing > 0 ? d + 1 : d;
+                        corner[u] = i;
+                        corner[v] = j;
+                        rect r = {corner, glm::uvec3(0), glm::uvec3(0), facing > 0};
+                        r.du[u] = w;
+                        r.dv[v] = h;
+                        rects.push_back(r);
+                        for (const glm::uvec3& p : {corner, corner + r.du, corner + r.du + r.dv, corner + r.dv}) {
+                            corners[point_index(p)] = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    ov.clear();
+    of.clear();
+    std::unordered_map<uint64_t, unsigned int> indices;
+    auto vertex = [&](glm::uvec3 point) {
+        if (weld_vertices_) {
+            auto found = indices.emplace(lattice_key(point), ov.size());
+            if (!found.second) return found.first->second;
+        }
+        ov.push_back(glm::vec4(glm::vec3(point) * inv_side - 0.5f, 1.0f));
+        return static_cast<unsigned int>(ov.size() - 1);
+    };
+
+    std::vector<glm::ivec3> polygon;
+    std::vector<unsigned int> outline;
+    for (const rect& r : rects) {
+        // Counter-clockwise around the rectangle, seen from +axis
+        const glm::uvec3 start[4] = {r.corner, r.corner + r.du, r.corner + r.du + r.dv, r.corner + r.dv};
+        const unsigned int lu = r.du[0] + r.du[1] + r.du[2], lv = r.dv[0] + r.dv[1] + r.dv[2];
+        const glm::ivec3 step[4] = {glm::ivec3(r.du) / int(lu), glm::ivec3(r.dv) / int(lv),
+            -glm::ivec3(r.du) / int(lu), -glm::ivec3(r.dv) / int(lv)};
+        const unsigned int length[4] = {lu, lv, lu, lv};
+        polygon.clear();
+        outline.clear();
+        for (int e = 0; e < 4; ++e) {
+            for (unsigned int k = 0; k < length[e]; ++k) {
+                const glm::ivec3 p = glm::ivec3(start[e]) + step[e] * int(k);
+                if (k == 0 || corners[point_index(glm::uvec3(p))]) {
+                    polygon.push_back(p);
+                    outline.push_back(vertex(glm::uvec3(p)));
+                }
+            }
+        }
+
+        // Ears are clipped until a triangle is left, n - 2 in all. A corner
+        // next to a flat point (one partway along a straight edge) goes first,
+        // since that makes the flat point a corner: the rest never collapses
+        // onto a line, and no triangle has three points on one edge.
+        auto triangle = [&](unsigned int a, unsigned int b, unsigned int c) {
+            of.push_back(r.front ? glm::uvec3(a, b, c) : glm::uvec3(a, c, b));
+        };
+        auto flat = [&](size_t i) {
+            const size_t n = polygon.size();
+            return collinear(polygon[(i + n - 1) % n], polygon[i], polygon[(i + 1) % n]);
+        };
+        while (outline.size() > 3) {
+            const size_t n = outline.size();
+            size_t ear = n;
+            for (size_t i = 0; i < n; ++i) {
+                if (flat(i)) continue;
+                if (ear == n) ear = i;
+                if (flat((i + n - 1) % n) || flat((i + 1) % n)) {
+                    ear = i;
+                    break;
+                }
+            }
+            triangle(outline[(ear + n - 1) % n], outline[ear], outline[(ear + 1) % n]);
+            polygon.erase(polygon.begin() + ear);
+            outline.erase(outline.begin() + ear);
+        }
+        triangle(outline[0], outline[1], outline[2]);
+    }
+
+    // Merging implies culling; where it saves no triangles the culled cubes
+    // are kept instead
+    if (of.size() >= exposed * 2) {
+        Menger culled(*this);
+        culled.cull_hidden_ = true;
+        culled.merge_faces_ = false;
+        culled.gen_range(0, parent_count(level), ov, of);
+    }
+}
+
+// With cull_hidden_ set, cubes with every side pressed against a neighbour
+// are left out.
+void Menger::generate_instances(std::vector<glm::u16vec4>& obj_cells) const {
+    const int level = nesting_level_;
+    if (cull_hidden_) {
+        obj_cells.clear();
+        for_each_cube(level, [&](size_t, glm::uvec3 origin) {
+            if (visible_sides(origin, level)) {
+                obj_cells.push_back(glm::u16vec4(origin[0], origin[1], origin[2], 0));
+            }
+        });
+        return;
+    }
+
+    obj_cells.resize(cube_count(level));
+    glm::u16vec4* cells = obj_cells.data();
+    const long parents = parent_count(level);
+    #pragma omp parallel for if(parallel_ && parents > 1) schedule(static)
+    for (long parent = 0; parent < parents; ++parent) {
+        for_each_sibling(level, parent, [&](size_t i, glm::uvec3 origin) {
+            cells[i] = glm::u16vec4(origin[0], origin[1], origin[2], 0);
+        });
+    }
+}
+
+float Menger::cell_size() const {
+    return 1.0f / lattice_side(nesting_level_);
+}
+
+void Menger::unit_cube(
+	std::vector<glm::vec4>& obj_vertices,
+	std::vector<glm::uvec3>& obj_faces
+) {
+    obj_vertices = bc_ps;
+    obj_faces = bc_fs;
+}
+
+void Menger::generate_geometry_recursive(
+	std::vector<glm::vec4>& obj_vertices,
+	std::vector<glm::uvec3>& obj_faces
 ) const {
     obj_vertices.clear();
     obj_faces.clear();
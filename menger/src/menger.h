@@ -2,8 +2,12 @@
 #define MENGER_H
 
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <string>
 #include <vector>
 
+#include "meshcache.h"
+
 class Menger {
 public:
 	Menger();
@@ -11,13 +15,82 @@ public:
 	void set_nesting_level(int);
 	bool is_dirty() const;
 	void set_clean();
+	void set_dirty();
 	void generate_geometry(std::vector<glm::vec4>& obj_vertices,
 		std::vector<glm::uvec3>& obj_faces) const;
+	// Original recursive generator, kept as a baseline for benchmarks.
+	void generate_geometry_recursive(std::vector<glm::vec4>& obj_vertices,
+		std::vector<glm::uvec3>& obj_faces) const;
+	int nesting_level() const;
+	// Skip the sides of cubes that are pressed against a neighbour
+	void set_cull_hidden(bool);
+	bool cull_hidden() const;
+	// Share one vertex between all cubes meeting at a lattice point
+	void set_weld_vertices(bool);
+	bool weld_vertices() const;
+	// Merge coplanar outward faces into larger rectangles (implies culling).
+	// Only applies to single-mesh levels, not chunks.
+	void set_merge_faces(bool);
+	bool merge_faces() const;
+	// Split generation across OpenMP threads (when built with OpenMP). The
+	// output is identical either way.
+	void set_parallel(bool);
+
+	// generate_geometry output for the current settings in the binary mesh
+	// cache. map_cached() returns an invalid mapping if it isn't cached yet.
+	meshcache::mapped_mesh map_cached() const;
+	bool save_cached(const std::vector<glm::vec4>& obj_vertices,
+		const std::vector<glm::uvec3>& obj_faces) const;
+
+	// Instanced form: the lattice cell of every cube (xyz, w unused), to be
+	// drawn as copies of unit_cube scaled by cell_size()
+	void generate_instances(std::vector<glm::u16vec4>& obj_cells) const;
+	float cell_size() const;
+
+	// Levels past 4 are too big for one mesh. The sponge at level L is the
+	// level L - chunk_depth() sponge with every cube (chunk) replaced by a
+	// level chunk_depth() sponge, so they are drawn as instanced copies of
+	// one small sponge.
+	bool chunked() const;
+	size_t chunk_count() const;
+	// One chunk as its own mesh, culled against the whole sponge and small
+	// enough for 16-bit indices
+	void generate_chunk(size_t chunk, std::vector<glm::vec4>& obj_vertices,
+		std::vector<glm::u16vec3>& obj_faces) const;
+	// Lattice cell of every chunk, as generate_instances gives for the level
+	// chunk_depth() up, and the side of one
+	void generate_chunk_cells(std::vector<glm::u16vec4>& obj_cells) const;
+	float chunk_size() const;
+	static int chunk_depth();
+	// Sponge level (0 to chunk_depth()) to draw a chunk spanning `pixels`
+	// pixels with: the deepest whose smallest cubes still cover a couple of
+	// pixels, as finer holes would only alias
+	static int chunk_lod(float pixels);
+
+	static size_t cube_count(int level);
+	static void unit_cube(std::vector<glm::vec4>& obj_vertices,
+		std::vector<glm::uvec3>& obj_faces);
 private:
+    // Generators over the cubes under parents [begin, end)
+    template <typename Face>
+    void gen_range(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const;
+    template <typename Face>
+    void gen_cubes(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const;
+    template <typename Face>
+    void gen_visible(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const;
+    template <typename Face>
+    void gen_welded(size_t begin, size_t end, std::vector<glm::vec4>& ov, std::vector<Face>& of) const;
+    std::string cache_name() const;
+    uint64_t cache_params() const;
+    void gen_merged(std::vector<glm::vec4>& ov, std::vector<glm::uvec3>& of) const;
     void gen_sub_box(std::vector<glm::vec4>& ov, std::vector<glm::uvec3>& of, unsigned int depth) const;
 
 	int nesting_level_ = 0;
 	bool dirty_ = true;
+	bool cull_hidden_ = false;
+	bool weld_vertices_ = false;
+	bool merge_faces_ = false;
+	bool parallel_ = true;
 };
 
 #endif
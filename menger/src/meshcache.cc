@@ -0,0 +1,178 @@
+#include "meshcache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const char kMagic[4] = {'M', 'S', 'H', 'C'};
+    const uint32_t kVersion = 1;
+    const char* kCacheDir = ".meshcache";
+
+    // 48 bytes, so the vertex block that follows stays 16-byte aligned
+    struct header {
+        char magic[4];
+        uint32_t version;
+        uint64_t params;
+        uint64_t vertex_count;
+        uint64_t face_count;
+        uint64_t content_hash;
+        uint64_t reserved;
+    };
+    static_assert(sizeof(header) == 48, "mesh cache header must keep the vertex block aligned");
+
+    size_t file_size(const header& h) {
+        return sizeof(header) + h.vertex_count * sizeof(glm::vec4) + h.face_count * sizeof(glm::uvec3);
+    }
+
+    uint64_t content_hash(const glm::vec4* vertices, size_t vertex_count,
+            const glm::uvec3* faces, size_t face_count) {
+        uint64_t h = meshcache::hash(vertices, vertex_count * sizeof(glm::vec4));
+        return meshcache::hash(faces, face_count * sizeof(glm::uvec3), h);
+    }
+}
+
+uint64_t meshcache::hash(const void* data, size_t bytes, uint64_t seed) {
+    const uint64_t prime = 0x100000001b3ull;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed;
+    for (; bytes >= 8; bytes -= 8, p += 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        h = (h ^ word) * prime;
+    }
+    for (; bytes > 0; --bytes, ++p) {
+        h = (h ^ *p) * prime;
+    }
+    return h;
+}
+
+std::string meshcache::path(const std::string& name) {
+    return std::string(kCacheDir) + "/" + name + ".mesh";
+}
+
+meshcache::mapped_mesh::mapped_mesh(const std::string& name, uint64_t params) {
+    int fd = open(path(name).c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(header)) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            data_ = data;
+            size_ = st.st_size;
+        }
+    }
+    close(fd);
+    if (!data_) return;
+
+    const header& h = *static_cast<const header*>(data_);
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion || h.params != params
+            || file_size(h) != size_) {
+        unmap();
+    }
+}
+
+meshcache::mapped_mesh::mapped_mesh(mapped_mesh&& other) : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+meshcache::mapped_mesh& meshcache::mapped_mesh::operator=(mapped_mesh&& other) {
+    if (this != &other) {
+        unmap();
+        data_ = other.data_;
+        size_ = other.size_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+meshcache::mapped_mesh::~mapped_mesh() {
+    unmap();
+}
+
+void meshcache::mapped_mesh::unmap(void) {
+    if (data_) {
+        munmap(data_, size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+bool meshcache::mapped_mesh::valid(void) const {
+    return data_ != nullptr;
+}
+
+bool meshcache::mapped_mesh::verify(void) const {
+    return data_ && content_hash(vertices(), vertex_count(), faces(), face_count())
+        == static_cast<const header*>(data_)->content_hash;
+}
+
+const glm::vec4* meshcache::mapped_mesh::vertices(void) const {
+    return reinterpret_cast<const glm::vec4*>(static_cast<const char*>(data_) + sizeof(header));
+}
+
+size_t meshcache::mapped_mesh::vertex_count(void) const {
+    return data_ ? static_cast<const header*>(data_)->vertex_count : 0;
+}
+
+const glm::uvec3* meshcache::mapped_mesh::faces(void) const {
+    return reinterpret_cast<const glm::uvec3*>(vertices() + vertex_count());
+}
+
+size_t meshcache::mapped_mesh::face_count(void) const {
+    return data_ ? static_cast<const header*>(data_)->face_count : 0;
+}
+
+bool meshcache::save(const std::string& name, uint64_t params,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count) {
+    mkdir(kCacheDir, 0755);
+    header h;
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.params = params;
+    h.vertex_count = vertex_count;
+    h.face_count = face_count;
+    h.content_hash = content_hash(vertices, vertex_count, faces, face_count);
+    h.reserved = 0;
+
+    // Write next to the target and rename over it, so a reader never maps a
+    // half written file.
+    const std::string target = path(name);
+    const std::string temp = target + ".tmp" + std::to_string(getpid());
+    FILE* out = std::fopen(temp.c_str(), "wb");
+    if (!out) return false;
+    bool ok = std::fwrite(&h, sizeof(h), 1, out) == 1
+        && std::fwrite(vertices, sizeof(glm::vec4), vertex_count, out) == vertex_count
+        && std::fwrite(faces, sizeof(glm::uvec3), face_count, out) == face_count;
+    ok = std::fclose(out) == 0 && ok;
+    if (!ok || std::rename(temp.c_str(), target.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool meshcache::save(const std::string& name, uint64_t params,
+        const std::vector<glm::vec4>& obj_vertices, const std::vector<glm::uvec3>& obj_faces) {
+    return save(name, params, obj_vertices.data(), obj_vertices.size(), obj_faces.data(), obj_faces.size());
+}
+
+bool meshcache::load(const std::string& name, uint64_t params,
+        std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces) {
+    // Copying reads every page anyway, so the contents are checked too
+    mapped_mesh mesh(name, params);
+    if (!mesh.verify()) return false;
+    const unsigned int first = obj_vertices.size();
+    obj_vertices.insert(obj_vertices.end(), mesh.vertices(), mesh.vertices() + mesh.vertex_count());
+    obj_faces.reserve(obj_faces.size() + mesh.face_count());
+    for (size_t i = 0; i < mesh.face_count(); ++i) {
+        obj_faces.push_back(mesh.faces()[i] + first);
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk cache of generated or parsed triangle meshes. A cache file is a
+// fixed header followed by the vertex block (vec4) and the index block
+// (uvec3), laid out exactly as they are uploaded, so a mapped file can be
+// handed straight to glBufferData.
+//
+// The header records a hash of the parameters the mesh was built from and a
+// hash of its contents. Mapping only checks the header, the parameters and
+// the file size, so no page is read until it is used; a file that fails them
+// is treated as missing. The content hash is checked on demand by verify().
+namespace meshcache {
+    // Read-only mapping of a cache file. Invalid if the file is missing,
+    // stale or the wrong size.
+    class mapped_mesh {
+    public:
+        mapped_mesh() = default;
+        mapped_mesh(const std::string& name, uint64_t params);
+        mapped_mesh(mapped_mesh&& other);
+        mapped_mesh& operator=(mapped_mesh&& other);
+        mapped_mesh(const mapped_mesh&) = delete;
+        mapped_mesh& operator=(const mapped_mesh&) = delete;
+        ~mapped_mesh();
+
+        bool valid(void) const;
+        // Hashes the whole mapping against the header (reads every page)
+        bool verify(void) const;
+        const glm::vec4* vertices(void) const;
+        size_t vertex_count(void) const;
+        const glm::uvec3* faces(void) const;
+        size_t face_count(void) const;
+    private:
+        void unmap(void);
+
+        void* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // 64-bit FNV-1a style hash, eight bytes per step
+    uint64_t hash(const void* data, size_t bytes, uint64_t seed = 0xcbf29ce484222325ull);
+    // Where the cache file for `name` lives
+    std::string path(const std::string& name);
+
+    // Writes (atomically, via a rename) the cache file for `name`
+    bool save(const std::string& name, uint64_t params,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count);
+    bool save(const std::string& name, uint64_t params,
+        const std::vector<glm::vec4>& obj_vertices, const std::vector<glm::uvec3>& obj_faces);
+    // Appends a cached mesh to the vectors, offsetting its indices, for
+    // callers that keep their geometry in vectors. False if not cached or
+    // if the contents fail verify().
+    bool load(const std::string& name, uint64_t params,
+        std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces);
+}
+
+#endif
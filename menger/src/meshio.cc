@@ -0,0 +1,557 @@
+#include "meshio.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+    // Elements (vertices or faces) formatted per chunk
+    const size_t kChunkElements = 1 << 16;
+    // Longest line either kind of element can format to
+    const size_t kMaxVertexLine = 2 + 3 * 17 + 1;
+    const size_t kMaxFaceLine = 2 + 3 * 11 + 1;
+
+    char* format_u64(char* out, uint64_t value) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        while (n) {
+            *out++ = digits[--n];
+        }
+        return out;
+    }
+
+    // One chunk of text, covering elements [begin, end) of the vertices or
+    // the faces
+    struct chunk {
+        bool faces;
+        size_t begin;
+        size_t end;
+        std::vector<char> text;
+    };
+
+    bool little_endian(void) {
+        const uint32_t one = 1;
+        char first;
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    // Whether every index names one of the `vertex_count` vertices
+    bool faces_in_range(const glm::uvec3* faces, size_t face_count, size_t vertex_count) {
+        for (size_t i = 0; i < face_count; ++i) {
+            if (faces[i][0] >= vertex_count || faces[i][1] >= vertex_count || faces[i][2] >= vertex_count) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Fills a buffer of `stride` bytes per face, chunk by chunk in parallel,
+    // with pack(face, out)
+    template <typename Pack>
+    std::vector<char> pack_faces(size_t face_count, size_t stride, Pack pack) {
+        std::vector<char> packed(face_count * stride);
+        const long chunk_count = (face_count + kChunkElements - 1) / kChunkElements;
+        #pragma omp parallel for schedule(static)
+        for (long c = 0; c < chunk_count; ++c) {
+            const size_t end = std::min((c + 1) * kChunkElements, face_count);
+            for (size_t i = c * kChunkElements; i < end; ++i) {
+                pack(i, packed.data() + i * stride);
+            }
+        }
+        return packed;
+    }
+
+    bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char* skip_spaces(const char* in, const char* end) {
+        while (in < end && is_space(*in)) ++in;
+        return in;
+    }
+
+    const char* next_line(const char* in, const char* end) {
+        const char* newline = static_cast<const char*>(std::memchr(in, '\n', end - in));
+        return newline ? newline + 1 : end;
+    }
+
+    // Turns a 1-based or negative (relative) OBJ index into a 0-based one,
+    // or -1 if it is out of range
+    long resolve_index(long index, size_t count) {
+        if (index > 0 && size_t(index) <= count) return index - 1;
+        if (index < 0 && size_t(-index) <= count) return long(count) + index;
+        return -1;
+    }
+
+    bool write_all(int fd, const char* data, size_t bytes) {
+        while (bytes > 0) {
+            ssize_t written = write(fd, data, bytes);
+            if (written < 0) return false;
+            data += written;
+            bytes -= written;
+        }
+        return true;
+    }
+}
+
+char* meshio::format_uint(char* out, unsigned int value) {
+    return format_u64(out, value);
+}
+
+char* meshio::format_float(char* out, float value) {
+    double v = std::fabs(double(value));
+    // Outside the range six fixed decimals represent well, fall back to %g
+    if (!std::isfinite(value) || v >= 1e9 || (v != 0.0 && v < 1e-5)) {
+        return out + std::snprintf(out, 17, "%g", value);
+    }
+    uint64_t scaled = uint64_t(v * 1e6 + 0.5);
+    if (scaled == 0) {
+        *out++ = '0';
+        return out;
+    }
+    if (value < 0) {
+        *out++ = '-';
+    }
+    out = format_u64(out, scaled / 1000000);
+    uint64_t frac = scaled % 1000000;
+    if (frac) {
+        *out++ = '.';
+        int digits = 6;
+        while (frac % 10 == 0) {
+            frac /= 10;
+            --digits;
+        }
+        for (int i = digits - 1; i >= 0; --i) {
+            out[i] = '0' + frac % 10;
+            frac /= 10;
+        }
+        out += digits;
+    }
+    return out;
+}
+
+const char* meshio::parse_int(const char* in, const char* end, long& value) {
+    const char* p = in;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    const char* digits = p;
+    long result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        result = result * 10 + (*p - '0');
+    }
+    if (p == digits) return in;
+    value = negative ? -result : result;
+    return p;
+}
+
+const char* meshio::parse_float(const char* in, const char* end, float& value) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* p = in;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    // up to 19 significant digits go in the mantissa, the rest only scale it
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any) return in;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        long e;
+        const char* after = parse_int(p + 1, end, e);
+        if (after != p + 1) {
+            exponent += int(std::max(-400L, std::min(400L, e)));
+            p = after;
+        }
+    }
+    double result = double(mantissa);
+    if (exponent < 0) {
+        result = -exponent <= 22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+    }
+    value = float(negative ? -result : result);
+    return p;
+}
+
+namespace {
+    // Bytes of OBJ text per piece parsed on its own
+    const size_t kPieceBytes = size_t(1) << 20;
+
+    // A run of whole lines of an OBJ file. Faces keep their indices as
+    // written, since relative ones depend on what earlier pieces read.
+    struct obj_piece {
+        const char* begin;
+        const char* end;
+        std::vector<glm::vec4> positions;
+        std::vector<glm::vec4> normals;
+        // (position, normal) per corner, normal 0 when there is none
+        std::vector<glm::ivec2> corners;
+        // Per polygon: one past its last corner, and the positions and
+        // normals this piece had read before it
+        std::vector<glm::uvec3> polygons;
+        bool ok = true;
+    };
+
+    // Reads a face index into a 32-bit int; anything wider is out of range
+    const char* parse_index(const char* in, const char* end, int& value, bool& ok) {
+        long v = 0;
+        const char* after = meshio::parse_int(in, end, v);
+        ok = ok && v >= INT32_MIN && v <= INT32_MAX;
+        value = int(v);
+        return after;
+    }
+
+    void parse_piece(obj_piece& piece) {
+        const char* p = piece.begin;
+        const char* end = piece.end;
+        // No shorter line than "f 1 2 3" adds three corners
+        piece.corners.reserve((end - p) / 8 * 3);
+        while (p < end) {
+            p = skip_spaces(p, end);
+            const char* line_end = next_line(p, end);
+            if (end - p > 2 && p[0] == 'v' && (is_space(p[1]) || p[1] == 'n')) {
+                const bool normal = p[1] == 'n';
+                glm::vec4 v(0.0f, 0.0f, 0.0f, normal ? 0.0f : 1.0f);
+                const char* q = p + (normal ? 2 : 1);
+                for (int k = 0; k < 3; ++k) {
+                    q = meshio::parse_float(skip_spaces(q, line_end), line_end, v[k]);
+                }
+                (normal ? piece.normals : piece.positions).push_back(v);
+            } else if (end - p > 1 && p[0] == 'f' && is_space(p[1])) {
+                const char* q = skip_spaces(p + 1, line_end);
+                while (q < line_end && *q != '\n') {
+                    glm::ivec2 corner(0);
+                    const char* after = parse_index(q, line_end, corner[0], piece.ok);
+                    if (after == q) break;
+                    q = after;
+                    if (q < line_end && *q == '/') {
+                        int t;
+                        q = parse_index(q + 1, line_end, t, piece.ok);
+                        if (q < line_end && *q == '/') {
+                            q = parse_index(q + 1, line_end, corner[1], piece.ok);
+                        }
+                    }
+                    piece.corners.push_back(corner);
+                    q = skip_spaces(q, line_end);
+                }
+                piece.polygons.push_back(glm::uvec3(piece.corners.size(), piece.positions.size(), piece.normals.size()));
+            }
+            p = line_end;
+        }
+    }
+}
+
+// Pieces of about kPieceBytes, split after a line break, are parsed in
+// parallel. Their positions and normals are then joined, and their faces
+// resolved and paired with vertices in file order.
+bool meshio::load_obj(const std::string& file, obj_mesh& mesh) {
+    mesh.vertices.clear();
+    mesh.normals.clear();
+    mesh.faces.clear();
+
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    const size_t size = st.st_size;
+    void* data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    if (data) madvise(data, size, MADV_SEQUENTIAL);
+
+    const char* text = static_cast<const char*>(data);
+    std::vector<obj_piece> pieces;
+    for (const char* p = text; p < text + size;) {
+        const char* cut = text + std::min(size, size_t(p - text) + kPieceBytes);
+        cut = next_line(cut == text + size ? cut : cut - 1, text + size);
+        pieces.push_back(obj_piece());
+        pieces.back().begin = p;
+        pieces.back().end = cut;
+        p = cut;
+    }
+    const long piece_count = pieces.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (long i = 0; i < piece_count; ++i) {
+        parse_piece(pieces[i]);
+    }
+    if (data) munmap(data, size);
+
+    // Positions and normals read before each piece
+    std::vector<glm::uvec2> base(pieces.size() + 1, glm::uvec2(0));
+    bool ok = true;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        ok = ok && pieces[i].ok;
+        base[i + 1] = base[i] + glm::uvec2(pieces[i].positions.size(), pieces[i].normals.size());
+    }
+    std::vector<glm::vec4> normals(base.back()[1]);
+    mesh.vertices.resize(base.back()[0]);
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < piece_count; ++i) {
+        std::copy(pieces[i].positions.begin(), pieces[i].positions.end(), mesh.vertices.begin() + base[i][0]);
+        std::copy(pieces[i].normals.begin(), pieces[i].normals.end(), normals.begin() + base[i][1]);
+        std::vector<glm::vec4>().swap(pieces[i].positions);
+        std::vector<glm::vec4>().swap(pieces[i].normals);
+    }
+    const size_t position_count = mesh.vertices.size();
+
+    // Each position doubles as the vertex for the first normal it is used
+    // with, so files with one normal per position keep their vertex order.
+    // Other pairings become extra vertices, numbered with kExtra set until
+    // the position count is known.
+    const uint32_t kUnused = UINT32_MAX, kNone = UINT32_MAX - 1, kExtra = 1u << 31;
+    std::vector<uint32_t> first_normal(position_count, kUnused);
+    std::vector<glm::uvec2> extras;
+    std::unordered_map<uint64_t, uint32_t> extra_index;
+
+    auto vertex = [&](uint32_t position, uint32_t normal) {
+        if (first_normal[position] == kUnused) {
+            first_normal[position] = normal;
+        }
+        if (first_normal[position] == normal) {
+            return position;
+        }
+        auto found = extra_index.emplace((uint64_t(position) << 32) | normal, extras.size());
+        if (found.second) {
+            extras.push_back(glm::uvec2(position, normal));
+        }
+        return found.first->second | kExtra;
+    };
+
+    size_t triangles = 0;
+    for (const obj_piece& piece : pieces) {
+        uint32_t first = 0;
+        for (const glm::uvec3& poly : piece.polygons) {
+            triangles += poly[0] - first > 2 ? poly[0] - first - 2 : 0;
+            first = poly[0];
+        }
+    }
+    mesh.faces.reserve(triangles);
+    for (size_t i = 0; ok && i < pieces.size(); ++i) {
+        const obj_piece& piece = pieces[i];
+        uint32_t first = 0;
+        for (const glm::uvec3& poly : piece.polygons) {
+            const size_t positions = base[i][0] + poly[1], normal_count = base[i][1] + poly[2];
+            // Fanned as the corners resolve: (first, previous, this one)
+            glm::uvec3 face;
+            for (uint32_t c = first; ok && c < poly[0]; ++c) {
+                const glm::ivec2 corner = piece.corners[c];
+                const long position = resolve_index(corner[0], positions);
+                const long normal = corner[1] ? resolve_index(corner[1], normal_count) : 0;
+                ok = position >= 0 && normal >= 0;
+                if (!ok) break;
+                face[std::min<uint32_t>(c - first, 2)] = vertex(position, corner[1] ? uint32_t(normal) : kNone);
+                if (c - first >= 2) {
+                    mesh.faces.push_back(face);
+                    face[1] = face[2];
+                }
+            }
+            first = poly[0];
+        }
+    }
+    ok = ok && position_count + extras.size() < kExtra;
+    if (!ok) {
+        mesh.vertices.clear();
+        mesh.faces.clear();
+        return false;
+    }
+
+    auto normal_of = [&](uint32_t normal) {
+        return normal < normals.size() ? normals[normal] : glm::vec4(0.0f);
+    };
+    mesh.normals.resize(position_count);
+    for (size_t i = 0; i < position_count; ++i) {
+        mesh.normals[i] = normal_of(first_normal[i]);
+    }
+    mesh.vertices.reserve(position_count + extras.size());
+    for (const auto& extra : extras) {
+        mesh.vertices.push_back(mesh.vertices[extra[0]]);
+        mesh.normals.push_back(normal_of(extra[1]));
+    }
+    if (!extras.empty()) {
+        for (auto& f : mesh.faces) {
+            for (int k = 0; k < 3; ++k) {
+                if (f[k] & kExtra) f[k] = position_count + (f[k] & ~kExtra);
+            }
+        }
+    }
+
+    // Area weighted face normals for the vertices the file gave none, summed
+    // serially in face order so the result does not depend on the threads
+    const long vertex_count = mesh.normals.size();
+    std::vector<char> missing(vertex_count);
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < vertex_count; ++i) {
+        missing[i] = mesh.normals[i] == glm::vec4(0.0f);
+    }
+    for (const glm::uvec3& f : mesh.faces) {
+        if (!missing[f[0]] && !missing[f[1]] && !missing[f[2]]) continue;
+        const glm::vec3 p0(mesh.vertices[f[0]]), p1(mesh.vertices[f[1]]), p2(mesh.vertices[f[2]]);
+        const glm::vec4 normal(glm::cross(p1 - p0, p2 - p0), 0.0f);
+        for (int k = 0; k < 3; ++k) {
+            if (missing[f[k]]) mesh.normals[f[k]] += normal;
+        }
+    }
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < vertex_count; ++i) {
+        if (glm::length(mesh.normals[i]) > 0.0f) {
+            mesh.normals[i] = glm::normalize(mesh.normals[i]);
+        }
+    }
+    return true;
+}
+
+bool meshio::save_obj(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count) {
+    std::vector<chunk> chunks;
+    for (size_t i = 0; i < vertex_count; i += kChunkElements) {
+        chunks.push_back({false, i, std::min(i + kChunkElements, vertex_count), {}});
+    }
+    for (size_t i = 0; i < face_count; i += kChunkElements) {
+        chunks.push_back({true, i, std::min(i + kChunkElements, face_count), {}});
+    }
+
+    const long chunk_count = chunks.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (long c = 0; c < chunk_count; ++c) {
+        chunk& ch = chunks[c];
+        ch.text.resize((ch.end - ch.begin) * (ch.faces ? kMaxFaceLine : kMaxVertexLine));
+        char* out = ch.text.data();
+        for (size_t i = ch.begin; i < ch.end; ++i) {
+            if (ch.faces) {
+                *out++ = 'f';
+                for (int k = 0; k < 3; ++k) {
+                    *out++ = ' ';
+                    out = format_uint(out, faces[i][k] + 1);
+                }
+            } else {
+                *out++ = 'v';
+                for (int k = 0; k < 3; ++k) {
+                    *out++ = ' ';
+                    out = format_float(out, vertices[i][k]);
+                }
+            }
+            *out++ = '\n';
+        }
+        ch.text.resize(out - ch.text.data());
+    }
+
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    for (const auto& ch : chunks) {
+        ok = ok && write_all(fd, ch.text.data(), ch.text.size());
+    }
+    return close(fd) == 0 && ok;
+}
+
+bool meshio::save_obj(const std::string& file,
+        const std::vector<glm::vec4>& obj_vertices, const std::vector<glm::uvec3>& obj_faces) {
+    return save_obj(file, obj_vertices.data(), obj_vertices.size(), obj_faces.data(), obj_faces.size());
+}
+
+bool meshio::save(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count) {
+    auto ends_with = [&](const std::string& ext) {
+        return file.size() >= ext.size() && file.compare(file.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    if (ends_with(".ply")) {
+        return save_ply(file, vertices, vertex_count, faces, face_count);
+    } else if (ends_with(".stl")) {
+        return save_stl(file, vertices, vertex_count, faces, face_count);
+    }
+    return save_obj(file, vertices, vertex_count, faces, face_count);
+}
+
+bool meshio::save_ply(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count) {
+    if (!little_endian() || !faces_in_range(faces, face_count, vertex_count)) return false;
+    const std::string header = "ply\nformat binary_little_endian 1.0\n"
+        "element vertex " + std::to_string(vertex_count) + "\n"
+        "property float x\nproperty float y\nproperty float z\nproperty float w\n"
+        "element face " + std::to_string(face_count) + "\n"
+        "property list uchar uint vertex_indices\nend_header\n";
+    // a face is its vertex count (always 3) followed by the indices
+    const size_t stride = 1 + sizeof(glm::uvec3);
+    std::vector<char> packed = pack_faces(face_count, stride, [&](size_t i, char* out) {
+        *out = 3;
+        std::memcpy(out + 1, &faces[i], sizeof(glm::uvec3));
+    });
+
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, header.data(), header.size())
+        && write_all(fd, reinterpret_cast<const char*>(vertices), vertex_count * sizeof(glm::vec4))
+        && write_all(fd, packed.data(), packed.size());
+    return close(fd) == 0 && ok;
+}
+
+bool meshio::save_stl(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count) {
+    if (!little_endian() || face_count > UINT32_MAX || !faces_in_range(faces, face_count, vertex_count)) {
+        return false;
+    }
+    char header[84] = "binary STL";
+    const uint32_t count = face_count;
+    std::memcpy(header + 80, &count, sizeof(count));
+    // normal, three corners, then a 16-bit attribute count left at 0
+    const size_t stride = 12 * sizeof(float) + sizeof(uint16_t);
+    std::vector<char> packed = pack_faces(face_count, stride, [&](size_t i, char* out) {
+        const glm::vec3 p0(vertices[faces[i][0]]), p1(vertices[faces[i][1]]), p2(vertices[faces[i][2]]);
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const float length = glm::length(normal);
+        if (length > 0.0f) normal /= length;
+        const float values[12] = {
+            normal[0], normal[1], normal[2],
+            p0[0], p0[1], p0[2], p1[0], p1[1], p1[2], p2[0], p2[1], p2[2]
+        };
+        std::memcpy(out, values, sizeof(values));
+        std::memset(out + sizeof(values), 0, sizeof(uint16_t));
+    });
+
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, header, sizeof(header)) && write_all(fd, packed.data(), packed.size());
+    return close(fd) == 0 && ok;
+}
@@ -0,0 +1,60 @@
+#ifndef __MESHIO_H__
+#define __MESHIO_H__
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Mesh file import and export. Text is formatted in chunks (in parallel
+// under OpenMP) and written with a few large writes instead of one stream
+// insertion per number. The binary formats copy straight from the arrays,
+// little endian.
+namespace meshio {
+    // Indexed triangle mesh read from an OBJ file. A vertex is a distinct
+    // position/normal pair; normals has one entry per vertex (w = 0), and is
+    // filled from the face normals where the file gives none.
+    struct obj_mesh {
+        std::vector<glm::vec4> vertices;
+        std::vector<glm::vec4> normals;
+        std::vector<glm::uvec3> faces;
+    };
+    // Memory maps and parses `file`: v, vn and f lines, with v, v/t, v//n
+    // and v/t/n corners (negative indices too), polygons fanned into
+    // triangles. Everything else is skipped. False if the file can't be read
+    // or a face points past the vertices read so far.
+    bool load_obj(const std::string& file, obj_mesh& mesh);
+
+    // Picks the writer from the file extension: .obj, .ply or .stl
+    bool save(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count);
+
+    bool save_obj(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count);
+    bool save_obj(const std::string& file,
+        const std::vector<glm::vec4>& obj_vertices, const std::vector<glm::uvec3>& obj_faces);
+
+    // Binary little endian PLY. Vertices keep their w as a fourth property
+    // so the vertex block is written as is. Both binary writers return
+    // false, writing nothing, if a face indexes past `vertex_count`.
+    bool save_ply(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count);
+    // Binary STL: unindexed triangles with flat normals
+    bool save_stl(const std::string& file,
+        const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count);
+
+    // Number formatting used by the text writers, exposed for testing in
+    // bench mode. Both write at `out` and return one past the last char.
+    // Floats print with up to six decimals, trailing zeros dropped.
+    char* format_uint(char* out, unsigned int value);
+    char* format_float(char* out, float value);
+    // Parsing used by load_obj: reads a number at `in`, no further than
+    // `end`, and returns one past it (or `in` if there is no number).
+    const char* parse_int(const char* in, const char* end, long& value);
+    const char* parse_float(const char* in, const char* end, float& value);
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    // 0-5: +x, -x, +y, -y, +z, -z
+    template <typename Face>
+    int normal_group(const glm::vec4* vertices, const Face& f) {
+        const glm::vec3 p0(vertices[f[0]]);
+        const glm::vec3 n = glm::cross(glm::vec3(vertices[f[1]]) - p0, glm::vec3(vertices[f[2]]) - p0);
+        const glm::vec3 a = glm::abs(n);
+        const int axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+        return axis * 2 + (n[axis] < 0.0f);
+    }
+
+    const int kNumGroups = 6;
+
+    // Stable counting sort on the group
+    template <typename Face>
+    std::vector<size_t> sort_by_group(const std::vector<glm::vec4>& vertices, std::vector<Face>& faces) {
+        std::vector<unsigned char> group(faces.size());
+        std::vector<size_t> offsets(kNumGroups + 1, 0);
+        for (size_t t = 0; t < faces.size(); ++t) {
+            group[t] = normal_group(vertices.data(), faces[t]);
+            ++offsets[group[t] + 1];
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<Face> sorted(faces.size());
+        std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < faces.size(); ++t) {
+            sorted[fill[group[t]]++] = faces[t];
+        }
+        faces.swap(sorted);
+        return offsets;
+    }
+
+    template <typename Face>
+    meshlet::cluster bound(const glm::vec4* vertices, const Face* faces, size_t first, size_t count) {
+        meshlet::cluster c;
+        c.first_face = first;
+        c.face_count = count;
+
+        // Unit face normals, zero for degenerate faces
+        glm::vec3 normals[meshlet::kMaxTriangles];
+        glm::vec3 lo(vertices[faces[first][0]]), hi = lo;
+        glm::vec3 normal_sum(0.0f);
+        for (size_t i = 0; i < count; ++i) {
+            const Face& f = faces[first + i];
+            const glm::vec3 p0(vertices[f[0]]), p1(vertices[f[1]]), p2(vertices[f[2]]);
+            lo = glm::min(lo, glm::min(p0, glm::min(p1, p2)));
+            hi = glm::max(hi, glm::max(p0, glm::max(p1, p2)));
+            const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            const float n2 = glm::dot(n, n);
+            normals[i] = n2 > 0.0f ? n / std::sqrt(n2) : glm::vec3(0.0f);
+            normal_sum += normals[i];
+        }
+        c.centre = (lo + hi) * 0.5f;
+        float radius2 = 0.0f;
+        for (size_t i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                const glm::vec3 d = glm::vec3(vertices[faces[first + i][k]]) - c.centre;
+                radius2 = std::max(radius2, glm::dot(d, d));
+            }
+        }
+        c.radius = std::sqrt(radius2);
+
+        // Widest angle between the mean normal and any face normal
+        c.cone_axis = glm::length(normal_sum) > 0.0f ? glm::normalize(normal_sum) : glm::vec3(0.0f, 0.0f, 1.0f);
+        float min_cos = 1.0f;
+        for (size_t i = 0; i < count; ++i) {
+            if (normals[i] != glm::vec3(0.0f)) min_cos = std::min(min_cos, glm::dot(c.cone_axis, normals[i]));
+        }
+        c.cone_cutoff = min_cos <= 0.0f ? 2.0f : std::sqrt(1.0f - min_cos * min_cos);
+        return c;
+    }
+
+    // Greedy split of the faces in order; `seen` marks vertices already in
+    // the current cluster with its index
+    template <typename Face>
+    std::vector<meshlet::cluster> build_clusters(const glm::vec4* vertices, size_t vertex_count,
+            const Face* faces, size_t face_count) {
+        std::vector<meshlet::cluster> clusters;
+        std::vector<unsigned int> seen(vertex_count, 0);
+        unsigned int id = 1;
+        size_t first = 0, cluster_vertices = 0;
+        int group = face_count ? normal_group(vertices, faces[0]) : 0;
+        for (size_t t = 0; t < face_count; ++t) {
+            size_t added = 0;
+            for (int k = 0; k < 3; ++k) {
+                if (seen[faces[t][k]] != id) ++added;
+            }
+            const int face_group = normal_group(vertices, faces[t]);
+            if (t > first && (cluster_vertices + added > meshlet::kMaxVertices || t - first == meshlet::kMaxTriangles
+                    || face_group != group)) {
+                clusters.push_back(bound(vertices, faces, first, t - first));
+                first = t;
+                cluster_vertices = 0;
+                ++id;
+            }
+            group = face_group;
+            for (int k = 0; k < 3; ++k) {
+                if (seen[faces[t][k]] != id) {
+                    seen[faces[t][k]] = id;
+                    ++cluster_vertices;
+                }
+            }
+        }
+        if (face_count > first) {
+            clusters.push_back(bound(vertices, faces, first, face_count - first));
+        }
+        return clusters;
+    }
+}
+
+std::vector<size_t> meshlet::sort_faces(const std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>& faces) {
+    return sort_by_group(vertices, faces);
+}
+
+std::vector<size_t> meshlet::sort_faces(const std::vector<glm::vec4>& vertices, std::vector<glm::u16vec3>& faces) {
+    return sort_by_group(vertices, faces);
+}
+
+std::vector<meshlet::cluster> meshlet::build(const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count) {
+    return build_clusters(vertices, vertex_count, faces, face_count);
+}
+
+std::vector<meshlet::cluster> meshlet::build(const glm::vec4* vertices, size_t vertex_count,
+        const glm::u16vec3* faces, size_t face_count) {
+    return build_clusters(vertices, vertex_count, faces, face_count);
+}
+
+meshlet::frustum meshlet::extract_frustum(const glm::mat4& m) {
+    // Gribb and Hartmann: each plane is the last row plus or minus another
+    const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    frustum f;
+    f.planes[0] = row3 + row0;
+    f.planes[1] = row3 - row0;
+    f.planes[2] = row3 + row1;
+    f.planes[3] = row3 - row1;
+    f.planes[4] = row3 + row2;
+    f.planes[5] = row3 - row2;
+    for (auto& plane : f.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return f;
+}
+
+bool meshlet::visible(const frustum& f, const glm::vec3& centre, float radius) {
+    for (const auto& plane : f.planes) {
+        if (glm::dot(glm::vec3(plane), centre) + plane.w < -radius) return false;
+    }
+    return true;
+}
+
+bool meshlet::visible(const cluster& c, const frustum& f, const glm::vec3& eye, bool cull_back_faces) {
+    if (!visible(f, c.centre, c.radius)) return false;
+    if (cull_back_faces) {
+        const glm::vec3 to_centre = c.centre - eye;
+        if (glm::dot(to_centre, c.cone_axis) >= c.cone_cutoff * glm::length(to_centre) + c.radius) return false;
+    }
+    return true;
+}
+
+size_t meshlet::cull(const std::vector<cluster>& clusters, const frustum& f, const glm::vec3& eye,
+        bool cull_back_faces, std::vector<glm::uvec2>& ranges) {
+    ranges.clear();
+    size_t kept = 0;
+    for (const auto& c : clusters) {
+        if (!visible(c, f, eye, cull_back_faces)) continue;
+        if (!ranges.empty() && ranges.back().x + ranges.back().y == c.first_face) {
+            ranges.back().y += c.face_count;
+        } else {
+            ranges.push_back(glm::uvec2(c.first_face, c.face_count));
+        }
+        kept += c.face_count;
+    }
+    return kept;
+}
@@ -0,0 +1,58 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <vector>
+
+// Splits an index buffer into small clusters of triangles with bounds, so
+// the renderer can skip the ones outside the frustum or facing away from
+// the camera and draw the rest as index ranges.
+namespace meshlet {
+    // Cluster limits: a cluster ends once either would be exceeded
+    const size_t kMaxVertices = 64;
+    const size_t kMaxTriangles = 124;
+
+    // A run of faces in the index buffer. Faces are kept in their original
+    // order, so a cache optimized buffer stays optimized.
+    struct cluster {
+        unsigned int first_face;
+        unsigned int face_count;
+        glm::vec3 centre;
+        float radius;
+        // Every face normal lies within the cone around cone_axis; cone_cutoff
+        // is the sine of its half angle, above 1 when the faces turn too far
+        // for the cluster to ever be entirely back facing.
+        glm::vec3 cone_axis;
+        float cone_cutoff;
+    };
+
+    // Groups faces by the axis their normal is closest to, keeping their
+    // order within a group, and returns the offset of each of the six
+    // groups followed by the face count. Clusters never span two groups, so
+    // on a sorted buffer their normal cones stay narrow enough to cull.
+    // Faces are counter clockwise seen from the front.
+    std::vector<size_t> sort_faces(const std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>& faces);
+    std::vector<size_t> sort_faces(const std::vector<glm::vec4>& vertices, std::vector<glm::u16vec3>& faces);
+
+    std::vector<cluster> build(const glm::vec4* vertices, size_t vertex_count,
+        const glm::uvec3* faces, size_t face_count);
+    std::vector<cluster> build(const glm::vec4* vertices, size_t vertex_count,
+        const glm::u16vec3* faces, size_t face_count);
+
+    // Frustum planes from projection * view, normals pointing inwards
+    struct frustum {
+        glm::vec4 planes[6];
+    };
+    frustum extract_frustum(const glm::mat4& view_projection);
+
+    bool visible(const cluster& c, const frustum& f, const glm::vec3& eye, bool cull_back_faces);
+    // Whether a sphere is at least partly inside the frustum
+    bool visible(const frustum& f, const glm::vec3& centre, float radius);
+    // Face ranges (first face, face count) of the visible clusters, with
+    // neighbouring ranges joined. Returns the number of faces kept.
+    size_t cull(const std::vector<cluster>& clusters, const frustum& f, const glm::vec3& eye,
+        bool cull_back_faces, std::vector<glm::uvec2>& ranges);
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include "meshopt.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+
+namespace {
+    // Largest ACMR increase optimize accepts from overdraw ordering
+    const float kOverdrawThreshold = 1.05f;
+
+    // Triangles using each vertex, as offsets into one flat list
+    struct adjacency {
+        std::vector<unsigned int> offsets;
+        std::vector<unsigned int> faces;
+
+        adjacency(const glm::uvec3* mesh_faces, size_t face_count, size_t vertex_count) : offsets(vertex_count + 1, 0) {
+            for (size_t t = 0; t < face_count; ++t) {
+                for (int k = 0; k < 3; ++k) ++offsets[mesh_faces[t][k] + 1];
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            faces.resize(offsets.back());
+            std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t t = 0; t < face_count; ++t) {
+                for (int k = 0; k < 3; ++k) faces[fill[mesh_faces[t][k]]++] = t;
+            }
+        }
+    };
+}
+
+float meshopt::acmr(const std::vector<glm::uvec3>& faces, size_t vertex_count, int cache_size) {
+    if (faces.empty()) return 0.0f;
+    // A vertex is in the FIFO if it was pushed less than cache_size misses ago
+    std::vector<size_t> pushed_at(vertex_count, SIZE_MAX);
+    size_t misses = 0;
+    for (const auto& f : faces) {
+        for (int k = 0; k < 3; ++k) {
+            if (pushed_at[f[k]] == SIZE_MAX || misses - pushed_at[f[k]] >= size_t(cache_size)) {
+                pushed_at[f[k]] = misses++;
+            }
+        }
+    }
+    return float(misses) / faces.size();
+}
+
+void meshopt::optimize_vertex_cache(std::vector<glm::uvec3>& faces, size_t vertex_count,
+        std::vector<size_t>* clusters, int cache_size) {
+    optimize_vertex_cache(faces.data(), faces.size(), vertex_count, clusters, cache_size);
+}
+
+void meshopt::optimize_vertex_cache(glm::uvec3* faces, size_t face_count, size_t vertex_count,
+        std::vector<size_t>* clusters, int cache_size) {
+    if (face_count == 0) return;
+    const adjacency adj(faces, face_count, vertex_count);
+    std::vector<int> live(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        live[v] = adj.offsets[v + 1] - adj.offsets[v];
+    }
+    std::vector<int> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(face_count, false);
+    std::vector<unsigned int> dead_end;
+    std::vector<unsigned int> candidates;
+    std::vector<glm::uvec3> output;
+    output.reserve(face_count);
+    if (clusters) {
+        clusters->assign(1, 0);
+    }
+
+    int time = cache_size + 1;
+    size_t cursor = 0;
+    long fan = 0;
+    while (fan >= 0) {
+        candidates.clear();
+        for (unsigned int i = adj.offsets[fan]; i < adj.offsets[fan + 1]; ++i) {
+            const unsigned int t = adj.faces[i];
+            if (emitted[t]) continue;
+            emitted[t] = true;
+            output.push_back(faces[t]);
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int v = faces[t][k];
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cache_time[v] > cache_size) {
+                    cache_time[v] = time++;
+                }
+            }
+        }
+
+        // Next fan: the candidate still in cache that will stay there the
+        // longest once its remaining triangles are emitted
+        long best = -1;
+        int best_priority = -1;
+        for (unsigned int v : candidates) {
+            if (live[v] <= 0) continue;
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size) {
+                priority = time - cache_time[v];
+            }
+            if (priority > best_priority) {
+                best_priority = priority;
+                best = v;
+            }
+        }
+        if (best >= 0) {
+            fan = best;
+            continue;
+        }
+
+        // Dead end: back up through recently used vertices, then scan on
+        while (!dead_end.empty() && best < 0) {
+            const unsigned int d = dead_end.back();
+            dead_end.pop_back();
+            if (live[d] > 0) best = d;
+        }
+        for (; best < 0 && cursor < vertex_count; ++cursor) {
+            if (live[cursor] > 0) best = cursor;
+        }
+        fan = best;
+        if (clusters && fan >= 0 && output.size() > clusters->back()) {
+            clusters->push_back(output.size());
+        }
+    }
+    std::copy(output.begin(), output.end(), faces);
+}
+
+void meshopt::optimize_overdraw(std::vector<glm::uvec3>& faces, const std::vector<glm::vec4>& vertices,
+        const std::vector<size_t>& clusters) {
+    if (faces.empty() || clusters.size() < 2) return;
+    glm::dvec3 mesh_centre(0.0);
+    double mesh_area = 0.0;
+    struct cluster {
+        size_t begin, end;
+        double sort_key;
+    };
+    std::vector<cluster> sorted;
+    std::vector<glm::dvec3> centres;
+    std::vector<glm::dvec3> normals;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+        const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : faces.size();
+        glm::dvec3 centre(0.0), normal(0.0);
+        double area = 0.0;
+        for (size_t t = clusters[c]; t < end; ++t) {
+            const glm::dvec3 p0(vertices[faces[t][0]]), p1(vertices[faces[t][1]]), p2(vertices[faces[t][2]]);
+            const glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+            const double a = glm::length(n);
+            centre += (p0 + p1 + p2) * (a / 3.0);
+            normal += n;
+            area += a;
+        }
+        mesh_centre += centre;
+        mesh_area += area;
+        sorted.push_back({clusters[c], end, 0.0});
+        centres.push_back(area > 0.0 ? centre / area : centre);
+        normals.push_back(glm::length(normal) > 0.0 ? glm::normalize(normal) : normal);
+    }
+    if (mesh_area > 0.0) mesh_centre /= mesh_area;
+    for (size_t c = 0; c < sorted.size(); ++c) {
+        sorted[c].sort_key = glm::dot(centres[c] - mesh_centre, normals[c]);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const cluster& a, const cluster& b) {
+        return a.sort_key > b.sort_key;
+    });
+
+    std::vector<glm::uvec3> output;
+    output.reserve(faces.size());
+    for (const auto& c : sorted) {
+        output.insert(output.end(), faces.begin() + c.begin, faces.begin() + c.end);
+    }
+    faces.swap(output);
+}
+
+std::vector<unsigned int> meshopt::optimize_vertex_fetch(std::vector<glm::uvec3>& faces, size_t vertex_count) {
+    const unsigned int kUnset = UINT32_MAX;
+    std::vector<unsigned int> new_index(vertex_count, kUnset);
+    unsigned int next = 0;
+    for (auto& f : faces) {
+        for (int k = 0; k < 3; ++k) {
+            if (new_index[f[k]] == kUnset) new_index[f[k]] = next++;
+            f[k] = new_index[f[k]];
+        }
+    }
+    for (auto& index : new_index) {
+        if (index == kUnset) index = next++;
+    }
+    return new_index;
+}
+
+std::vector<unsigned int> meshopt::optimize(std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>& faces,
+        const std::vector<size_t>* groups) {
+    // Tipsify works from vertex adjacency, so on unwelded meshes (a vertex
+    // per face corner) it can lose to the order the faces came in; any run
+    // it does not improve is left as it was
+    if (groups) {
+        std::vector<glm::uvec3> run;
+        for (size_t g = 0; g + 1 < groups->size(); ++g) {
+            glm::uvec3* first = faces.data() + (*groups)[g];
+            run.assign(first, faces.data() + (*groups)[g + 1]);
+            optimize_vertex_cache(run, vertices.size());
+            if (acmr(run, vertices.size()) < acmr(std::vector<glm::uvec3>(first, first + run.size()), vertices.size())) {
+                std::copy(run.begin(), run.end(), first);
+            }
+        }
+        std::vector<unsigned int> new_index = optimize_vertex_fetch(faces, vertices.size());
+        remap(vertices, new_index);
+        return new_index;
+    }
+
+    const float before = acmr(faces, vertices.size());
+    std::vector<glm::uvec3> reordered = faces;
+    std::vector<size_t> clusters;
+    optimize_vertex_cache(reordered, vertices.size(), &clusters);
+    // Cluster order trades some cache hits for less overdraw; keep it only
+    // while the cost stays small
+    const float cache_only = acmr(reordered, vertices.size());
+    std::vector<glm::uvec3> sorted = reordered;
+    optimize_overdraw(sorted, vertices, clusters);
+    const float with_overdraw = acmr(sorted, vertices.size());
+    if (with_overdraw <= cache_only * kOverdrawThreshold && with_overdraw < before) {
+        faces.swap(sorted);
+    } else if (cache_only < before) {
+        faces.swap(reordered);
+    }
+    std::vector<unsigned int> new_index = optimize_vertex_fetch(faces, vertices.size());
+    remap(vertices, new_index);
+    return new_index;
+}
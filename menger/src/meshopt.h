@@ -0,0 +1,53 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Index and vertex reordering for static triangle meshes, after Sander,
+// Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw" (Tipsify).
+namespace meshopt {
+    // Cache size the optimizer targets and ACMR is measured with
+    const int kCacheSize = 16;
+
+    // Average cache miss ratio: vertex shader runs per triangle through a
+    // FIFO post-transform cache of `cache_size` entries. 0.5 is the floor
+    // for large closed meshes, 3 the worst case.
+    float acmr(const std::vector<glm::uvec3>& faces, size_t vertex_count, int cache_size = kCacheSize);
+
+    // Tipsify: reorders faces for the post-transform cache. When
+    // `clusters` is given it receives the offset of every cluster (a run
+    // ended by a cache flush), for optimize_overdraw.
+    void optimize_vertex_cache(std::vector<glm::uvec3>& faces, size_t vertex_count,
+        std::vector<size_t>* clusters = nullptr, int cache_size = kCacheSize);
+    void optimize_vertex_cache(glm::uvec3* faces, size_t face_count, size_t vertex_count,
+        std::vector<size_t>* clusters = nullptr, int cache_size = kCacheSize);
+    // Sorts clusters so the ones facing away from the mesh centre, which
+    // tend to occlude the rest, are drawn first. Cache locality inside a
+    // cluster is kept.
+    void optimize_overdraw(std::vector<glm::uvec3>& faces, const std::vector<glm::vec4>& vertices,
+        const std::vector<size_t>& clusters);
+    // Numbers vertices in the order faces first use them and rewrites the
+    // faces to match. Returns the new index of each old vertex, for
+    // remapping other attribute arrays; unused vertices go last.
+    std::vector<unsigned int> optimize_vertex_fetch(std::vector<glm::uvec3>& faces, size_t vertex_count);
+
+    template <typename T>
+    void remap(std::vector<T>& attributes, const std::vector<unsigned int>& new_index) {
+        std::vector<T> remapped(attributes.size());
+        for (size_t i = 0; i < attributes.size(); ++i) {
+            remapped[new_index[i]] = attributes[i];
+        }
+        attributes.swap(remapped);
+    }
+
+    // All three passes. Returns the vertex remap for any extra attributes.
+    // With `groups` (face offsets of consecutive runs, last one the end, as
+    // from meshlet::sort_faces) faces stay within their run and overdraw
+    // ordering is skipped.
+    std::vector<unsigned int> optimize(std::vector<glm::vec4>& vertices, std::vector<glm::uvec3>& faces,
+        const std::vector<size_t>* groups = nullptr);
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include "meshpack.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace {
+    int16_t quantize(float unit) {
+        return int16_t(std::round(std::max(-1.0f, std::min(1.0f, unit)) * meshpack::kQuantMax));
+    }
+
+    float sign_not_zero(float v) {
+        return v < 0.0f ? -1.0f : 1.0f;
+    }
+}
+
+meshpack::bounds meshpack::mesh_bounds(const glm::vec4* vertices, size_t vertex_count) {
+    if (vertex_count == 0) return {glm::vec3(0.0f), glm::vec3(1.0f)};
+    glm::vec3 lo(vertices[0]), hi = lo;
+    for (size_t i = 1; i < vertex_count; ++i) {
+        lo = glm::min(lo, glm::vec3(vertices[i]));
+        hi = glm::max(hi, glm::vec3(vertices[i]));
+    }
+    // A flat axis still needs a non zero extent to divide by
+    return {(lo + hi) * 0.5f, glm::max((hi - lo) * 0.5f, glm::vec3(1e-6f))};
+}
+
+glm::mat4 meshpack::unpack_matrix(const bounds& b) {
+    glm::mat4 m(1.0f);
+    m[0][0] = b.extent.x / kQuantMax;
+    m[1][1] = b.extent.y / kQuantMax;
+    m[2][2] = b.extent.z / kQuantMax;
+    m[3] = glm::vec4(b.centre, 1.0f);
+    return m;
+}
+
+void meshpack::quantize_positions(const glm::vec4* vertices, size_t vertex_count, const bounds& b,
+        std::vector<glm::i16vec4>& out) {
+    out.resize(vertex_count);
+    for (size_t i = 0; i < vertex_count; ++i) {
+        const glm::vec3 unit = (glm::vec3(vertices[i]) - b.centre) / b.extent;
+        out[i] = glm::i16vec4(quantize(unit.x), quantize(unit.y), quantize(unit.z), 1);
+    }
+}
+
+glm::vec4 meshpack::dequantize_position(const glm::i16vec4& q, const bounds& b) {
+    return glm::vec4(b.centre + glm::vec3(q.x, q.y, q.z) * b.extent / float(kQuantMax), 1.0f);
+}
+
+glm::i16vec2 meshpack::encode_normal(const glm::vec3& n) {
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0.0f) return glm::i16vec2(0, 0);
+    float x = n.x / l1, y = n.y / l1;
+    if (n.z < 0.0f) {
+        const float fx = (1.0f - std::abs(y)) * sign_not_zero(x);
+        const float fy = (1.0f - std::abs(x)) * sign_not_zero(y);
+        x = fx;
+        y = fy;
+    }
+    return glm::i16vec2(quantize(x), quantize(y));
+}
+
+// Same as oct_decode in the shaders
+glm::vec3 meshpack::decode_normal(const glm::i16vec2& q) {
+    const float x = float(q.x) / kQuantMax, y = float(q.y) / kQuantMax;
+    glm::vec3 n(x, y, 1.0f - std::abs(x) - std::abs(y));
+    if (n.z < 0.0f) {
+        n.x = (1.0f - std::abs(y)) * sign_not_zero(x);
+        n.y = (1.0f - std::abs(x)) * sign_not_zero(y);
+    }
+    return glm::normalize(n);
+}
+
+void meshpack::pack_normals(const std::vector<glm::vec4>& normals, std::vector<glm::i16vec2>& out) {
+    out.resize(normals.size());
+    for (size_t i = 0; i < normals.size(); ++i) {
+        out[i] = encode_normal(glm::vec3(normals[i]));
+    }
+}
+
+bool meshpack::narrow_faces(const glm::uvec3* faces, size_t face_count, size_t vertex_count,
+        const std::vector<size_t>& cuts, std::vector<glm::u16vec3>& out, std::vector<batch>& batches,
+        std::vector<unsigned int>& source) {
+    const size_t kSpan = 65536;
+    out.resize(face_count);
+    batches.clear();
+    source.clear();
+    if (vertex_count <= kSpan) {
+        for (size_t i = 0; i < face_count; ++i) {
+            out[i] = glm::u16vec3(faces[i]);
+        }
+        batches.push_back({0, face_count, 0});
+        return true;
+    }
+
+    // Vertices of the open batch, which `local` numbers once it closes
+    std::vector<unsigned int> used;
+    std::vector<unsigned int> owner(vertex_count, UINT_MAX);
+    std::vector<unsigned int> local(vertex_count);
+    auto close = [&]() {
+        batch& run = batches.back();
+        // in mesh order, so fetch locality is kept
+        std::sort(used.begin(), used.end());
+        run.base_vertex = source.size();
+        for (size_t i = 0; i < used.size(); ++i) {
+            local[used[i]] = i;
+        }
+        source.insert(source.end(), used.begin(), used.end());
+        for (size_t i = run.first_face; i < run.first_face + run.face_count; ++i) {
+            out[i] = glm::u16vec3(local[faces[i][0]], local[faces[i][1]], local[faces[i][2]]);
+        }
+        used.clear();
+    };
+    size_t next_cut = 0;
+    for (size_t face = 0; face < face_count;) {
+        while (next_cut < cuts.size() && cuts[next_cut] <= face) ++next_cut;
+        const size_t end = cuts.empty() ? face + 1 : next_cut < cuts.size() ? std::min(cuts[next_cut], face_count) : face_count;
+        // Takes the piece into the open batch, or into a new one if it
+        // would overflow
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (batches.empty()) batches.push_back({face, 0, 0});
+            const size_t before = used.size();
+            const unsigned int id = batches.size() - 1;
+            for (size_t i = face; i < end; ++i) {
+                for (int k = 0; k < 3; ++k) {
+                    if (owner[faces[i][k]] == id) continue;
+                    owner[faces[i][k]] = id;
+                    used.push_back(faces[i][k]);
+                }
+            }
+            if (used.size() <= kSpan) break;
+            for (size_t i = before; i < used.size(); ++i) {
+                owner[used[i]] = UINT_MAX;
+            }
+            used.resize(before);
+            if (attempt || before == 0) {
+                out.clear();
+                batches.clear();
+                source.clear();
+                return false;
+            }
+            close();
+            batches.push_back({face, 0, 0});
+        }
+        batches.back().face_count = end - batches.back().first_face;
+        face = end;
+    }
+    if (!batches.empty()) close();
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef __MESHPACK_H__
+#define __MESHPACK_H__
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <vector>
+
+// Compact vertex layout for static meshes: positions as 16-bit integers
+// against the mesh bounds, normals octahedral in two 16-bit integers, and
+// 16-bit indices, relative to a base vertex per batch on large meshes.
+// Attributes are uploaded unnormalized; shaders scale them back with
+// `unpack` (positions) and oct_decode (normals).
+namespace meshpack {
+    const int kQuantMax = 32767;
+
+    // Axis aligned box the positions are quantized against
+    struct bounds {
+        glm::vec3 centre;
+        glm::vec3 extent;
+    };
+    bounds mesh_bounds(const glm::vec4* vertices, size_t vertex_count);
+    // Maps quantized positions (w = 1) back to the original space
+    glm::mat4 unpack_matrix(const bounds& b);
+
+    void quantize_positions(const glm::vec4* vertices, size_t vertex_count, const bounds& b,
+        std::vector<glm::i16vec4>& out);
+    glm::vec4 dequantize_position(const glm::i16vec4& q, const bounds& b);
+
+    // Octahedral mapping: the unit sphere folded onto the [-1, 1] square
+    glm::i16vec2 encode_normal(const glm::vec3& n);
+    glm::vec3 decode_normal(const glm::i16vec2& q);
+    void pack_normals(const std::vector<glm::vec4>& normals, std::vector<glm::i16vec2>& out);
+
+    // A run of faces whose indices are stored as 16-bit offsets from
+    // base_vertex, for glDrawElementsBaseVertex
+    struct batch {
+        size_t first_face;
+        size_t face_count;
+        unsigned int base_vertex;
+    };
+    // Narrows indices to 16 bits. A mesh of up to 65536 vertices comes out
+    // as one batch with base 0 and `source` empty. A larger one is cut
+    // into batches of at most 65536 vertices, only at `cuts` (ascending
+    // face indices such as cluster starts; anywhere when empty), and needs
+    // a new vertex buffer: vertex i of it is vertex source[i] of the mesh,
+    // each batch's vertices are contiguous from its base, and vertices
+    // batches share are repeated in each. False, leaving all three empty,
+    // if the faces between two cuts use more than 65536 vertices.
+    bool narrow_faces(const glm::uvec3* faces, size_t face_count, size_t vertex_count,
+        const std::vector<size_t>& cuts, std::vector<glm::u16vec3>& out, std::vector<batch>& batches,
+        std::vector<unsigned int>& source);
+}
+
+#endif
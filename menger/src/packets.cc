@@ -0,0 +1,135 @@
+#include "packets.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // h = amp w(d) cos(k u.dir - phase) with u = pos - centre, d = |u| and
+    // w = (1 + cos(pi d / r)) / 2
+    template <typename P>
+    void add_packet(const P& p, const glm::vec2& pos, fluid::surface_sample& out) {
+        const glm::vec2 u = pos - p.centre;
+        const float d2 = glm::dot(u, u);
+        if (d2 >= p.radius * p.radius) return;
+        const float d = std::sqrt(d2);
+        const float s = glm::pi<float>() / p.radius;
+        const float w = (1 + std::cos(s * d)) / 2;
+        const float theta = p.k * glm::dot(u, p.dir) - p.phase;
+        const float c = std::cos(theta), sn = std::sin(theta);
+        // dw/dd u / d, which goes to 0 at the centre
+        const glm::vec2 dw = d > 0 ? u * (-s / 2 * std::sin(s * d) / d) : glm::vec2(0.0f);
+        const glm::vec2 grad = p.amp * (dw * c - p.dir * (w * sn * p.k));
+        out.offset[1] += p.amp * w * c;
+        out.normal += glm::vec4(-grad.x, 0.0f, -grad.y, 0.0f);
+    }
+}
+
+fluid::packet_field::packet_field(const glm::vec2& lo, const glm::vec2& hi, float cell_size)
+    : lo_(lo), hi_(hi), cell_size_(cell_size),
+      cells_x_(std::max(1, int(std::ceil((hi.x - lo.x) / cell_size)))),
+      cells_z_(std::max(1, int(std::ceil((hi.y - lo.y) / cell_size)))),
+      cell_start_(size_t(cells_x_) * cells_z_ + 1, 0) {
+}
+
+void fluid::packet_field::update(double t, std::vector<wave_packet>& packets) {
+    for (size_t i = packets.size(); i-- > 0;) {
+        if (t - packets[i].start > packets[i].life || t < packets[i].start) {
+            packets[i] = packets.back();
+            packets.pop_back();
+        }
+    }
+
+    const double two_pi = 2 * glm::pi<double>();
+    placed_.resize(packets.size());
+    for (size_t i = 0; i < packets.size(); ++i) {
+        const wave_packet& packet = packets[i];
+        const double age = t - packet.start;
+        const float cal = age / packet.life;
+        const float k = 2 * glm::pi<float>() / packet.wavelength;
+        placed_[i] = {
+            packet.center + packet.dir * float(age * packet.speed), packet.dir,
+            k, float(std::fmod(k * packet.speed * age, two_pi)),
+            packet.amp * 4 * cal * (1 - cal), packet.radius
+        };
+    }
+
+    // Counting sort by cell: count, prefix sum, then fill
+    const size_t cells = size_t(cells_x_) * cells_z_;
+    std::vector<glm::ivec4> spans(placed_.size());
+    std::fill(cell_start_.begin(), cell_start_.end(), 0);
+    for (size_t i = 0; i < placed_.size(); ++i) {
+        const glm::vec2 a = (placed_[i].centre - placed_[i].radius - lo_) / cell_size_;
+        const glm::vec2 b = (placed_[i].centre + placed_[i].radius - lo_) / cell_size_;
+        spans[i] = glm::ivec4(std::max(0, int(std::floor(a.x))), std::min(cells_x_ - 1, int(std::floor(b.x))),
+            std::max(0, int(std::floor(a.y))), std::min(cells_z_ - 1, int(std::floor(b.y))));
+        for (int j = spans[i].z; j <= spans[i].w; ++j) {
+            for (int c = spans[i].x; c <= spans[i].y; ++c) {
+                ++cell_start_[size_t(j) * cells_x_ + c + 1];
+            }
+        }
+    }
+    for (size_t c = 0; c < cells; ++c) {
+        cell_start_[c + 1] += cell_start_[c];
+    }
+    cell_items_.resize(cell_start_[cells]);
+    std::vector<uint32_t> fill(cell_start_.begin(), cell_start_.end() - 1);
+    for (size_t i = 0; i < placed_.size(); ++i) {
+        for (int j = spans[i].z; j <= spans[i].w; ++j) {
+            for (int c = spans[i].x; c <= spans[i].y; ++c) {
+                cell_items_[fill[size_t(j) * cells_x_ + c]++] = uint32_t(i);
+            }
+        }
+    }
+}
+
+size_t fluid::packet_field::size(void) const {
+    return placed_.size();
+}
+
+bool fluid::packet_field::cell_of(const glm::vec2& pos, int& i, int& j) const {
+    if (pos.x < lo_.x || pos.y < lo_.y || pos.x > hi_.x || pos.y > hi_.y) return false;
+    i = std::min(cells_x_ - 1, int((pos.x - lo_.x) / cell_size_));
+    j = std::min(cells_z_ - 1, int((pos.y - lo_.y) / cell_size_));
+    return true;
+}
+
+fluid::surface_sample fluid::packet_field::sample(const glm::vec2& pos) const {
+    surface_sample out = {glm::vec4(0.0f), glm::vec4(0.0f)};
+    int i, j;
+    if (!cell_of(pos, i, j)) return out;
+    const size_t c = size_t(j) * cells_x_ + i;
+    for (uint32_t n = cell_start_[c]; n < cell_start_[c + 1]; ++n) {
+        add_packet(placed_[cell_items_[n]], pos, out);
+    }
+    return out;
+}
+
+fluid::surface_sample fluid::packet_field::sample_all(const glm::vec2& pos) const {
+    surface_sample out = {glm::vec4(0.0f), glm::vec4(0.0f)};
+    if (pos.x < lo_.x || pos.y < lo_.y || pos.x > hi_.x || pos.y > hi_.y) return out;
+    for (const placed& p : placed_) {
+        add_packet(p, pos, out);
+    }
+    return out;
+}
+
+size_t fluid::packet_field::cell_load(const glm::vec2& pos) const {
+    int i, j;
+    if (!cell_of(pos, i, j)) return 0;
+    const size_t c = size_t(j) * cells_x_ + i;
+    return cell_start_[c + 1] - cell_start_[c];
+}
+
+void fluid::packet_field::rasterize(int resolution, std::vector<glm::vec4>& out) const {
+    const glm::vec2 texel = (hi_ - lo_) / float(resolution);
+    out.resize(size_t(resolution) * resolution);
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < resolution; ++j) {
+        for (int i = 0; i < resolution; ++i) {
+            const surface_sample s = sample(lo_ + texel * glm::vec2(i + 0.5f, j + 0.5f));
+            out[size_t(j) * resolution + i] = glm::vec4(s.normal.x, s.offset[1], s.normal.z, 0.0f);
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __PACKETS_H__
+#define __PACKETS_H__
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "fluid.h"
+
+// Localized wave packets (wakes, impacts): a short train of waves under a
+// raised cosine envelope, travelling in a straight line and fading over its
+// life. A packet is zero past its radius, so they are binned once per update
+// into a uniform grid over the ocean, each into every cell its disc touches,
+// and a query only evaluates the packets binned in its own cell. Its cost
+// follows how many packets overlap the point, not how many there are.
+namespace fluid {
+    class packet_field {
+    public:
+        packet_field(const glm::vec2& lo = glm::vec2(-20.0f), const glm::vec2& hi = glm::vec2(20.0f),
+            float cell_size = 2.0f);
+
+        // Drops the packets that have outlived their life from `packets`
+        // (moving the last one into the hole), then places the rest at t
+        // seconds and bins them
+        void update(double t, std::vector<wave_packet>& packets);
+        size_t size(void) const;
+
+        // Height in offset.y and the slope in normal, as (-dh/dx, 0, -dh/dz);
+        // zero outside [lo, hi]
+        surface_sample sample(const glm::vec2& pos) const;
+        // The same from every packet, without the grid; for checking it
+        surface_sample sample_all(const glm::vec2& pos) const;
+        // Packets binned in the cell of pos
+        size_t cell_load(const glm::vec2& pos) const;
+        // resolution^2 samples of (-dh/dx, h, -dh/dz, 0) at the texel
+        // centres of [lo, hi], row by row along z, in parallel
+        void rasterize(int resolution, std::vector<glm::vec4>& out) const;
+    private:
+        // A packet at the time of the last update
+        struct placed {
+            glm::vec2 centre, dir;
+            float k, phase, amp, radius;
+        };
+        bool cell_of(const glm::vec2& pos, int& i, int& j) const;
+
+        glm::vec2 lo_, hi_;
+        float cell_size_;
+        int cells_x_, cells_z_;
+        std::vector<placed> placed_;
+        // Packet indices by cell; cell c holds cell_items_[cell_start_[c],
+        // cell_start_[c + 1])
+        std::vector<uint32_t> cell_start_, cell_items_;
+    };
+}
+
+#endif
@@ -57,6 +57,7 @@ namespace shaders {
     }
 
     GLSSS menger_sss ARRAY_INIT_SSS(menger);
+    GLSSS menger_instanced_sss ARRAY_INIT_SSS(menger_instanced);
     GLSSS floor_sss ARRAY_INIT_SSS(floor);
     GLSSS ocean_sss ARRAY_INIT_SSS(ocean);
     GLSSS light_sss ARRAY_INIT_SSS(light);
@@ -42,6 +42,7 @@ namespace shaders {
     };
 
     extern GLSSS menger_sss;
+    extern GLSSS menger_instanced_sss;
     extern GLSSS floor_sss;
     extern GLSSS ocean_sss;
     extern GLSSS light_sss;
@@ -8,78 +8,102 @@
 
 const char* tidal_fns =
 R"zzz(
-/* prereqs: tidal_time */
+/* prereqs: swell_block */
 #define M_PI 3.1415926535897932384626433832795
 
-/* gaussian tidal wave */
-float moving_gaussian_offset(vec2 pos, vec2 dir, vec2 center, float A, float sigma) {
-    vec2 n_c = dir * tidal_time + center;
-    float dist = distance(pos, n_c);
-    return A * exp(-(dist * dist) / (2 * sigma * sigma));
+/* gaussian swell (centre x, centre z, A, sigma), height and normal together;
+   nothing past 4 sigma */
+void moving_gaussian(vec2 pos, vec4 swell, inout vec4 offset, inout vec4 norm) {
+    vec2 d = swell.xy - pos;
+    float d2 = dot(d, d);
+    if (d2 >= 16 * swell.w * swell.w) return;
+    float g = swell.z * exp(-d2 / (2 * swell.w * swell.w));
+    float base = g / (swell.w * swell.w);
+    offset.y += g;
+    norm += vec4(-base * d.x, 0.0, base * d.y, 0.0);
 }
-vec4 tidal_offset(float x, float y) {
-    vec2 dir =      vec2(1, 0);
-    vec2 center =   vec2(0, 0);
-    float A =       5.0;
-    float sigma =   1.0;
-    return vec4(0.0f, moving_gaussian_offset(vec2(x, y), dir, center, A, sigma), 0.0f, 0.0f);
-}
-vec3 moving_gaussian_normal(vec2 pos, vec2 dir, vec2 center, float A, float sigma) {
-    vec2 n_c = dir * tidal_time + center;
-    float dist = distance(pos, n_c);
-    float dx = A * (n_c[0] - pos[0]) * exp(-(dist * dist) / (2 * sigma * sigma)) / (pow(sigma, 2));
-    float dy = A * (n_c[1] - pos[1]) * exp(-(dist * dist) / (2 * sigma * sigma)) / (pow(sigma, 2));
-    return vec3(-dx, 1, dy);
-}
-vec4 tidal_normal(float x, float y) {
-    vec2 dir =      vec2(1, 0);
-    vec2 center =   vec2(0, 0);
-    float A =       5.0;
-    float sigma =   1.0;
-    return vec4(moving_gaussian_normal(vec2(x, y), dir, center, A, sigma), 0.0);
+void tidal_surface(float x, float y, inout vec4 offset, inout vec4 norm) {
+    for (int i = 0; i < swell_count.x; ++i) {
+        moving_gaussian(vec2(x, y), swells[i], offset, norm);
+    }
+    norm.y += swell_count.x;
 }
 )zzz";
 
 const char* wave_fns =
 R"zzz(
-/* prereqs: wave_time */
+/* prereqs: wave_time, spectral, spectral_tile, spectral_size, packets, packet_tile, packet_lo, packet_hi */
 #define M_PI 3.1415926535897932384626433832795
 
-/* regular small waves */
-float single_wave_offset(vec2 wave_dir, vec2 pos, float A, float freq, float phase, float k) {
-    return 2 * A * pow((sin(dot(wave_dir, pos) * freq + wave_time * phase) + 1) / 2, k);
+/* regular small waves, height and normal together */
+void single_wave(vec2 wave_dir, vec2 pos, float A, float freq, float phase, float k, inout float y_shift, inout vec4 norm) {
+    float arg = dot(wave_dir, pos) * freq + wave_time * phase;
+    float base = (sin(arg) + 1) / 2;
+    // pow is undefined at 0 for k <= 1
+    float pow_k1 = pow(max(base, 1e-6), k - 1);
+    y_shift += 2 * A * pow_k1 * base;
+    float basis = k * freq * A * pow_k1 * cos(arg);
+    norm += vec4(-wave_dir[0] * basis, 1, -wave_dir[1] * basis, 0.0);
 }
-vec4 single_wave_normal(vec2 wave_dir, vec2 pos, float A, float freq, float phase, float k) {
-    float basis = k * freq * A * pow((sin(dot(wave_dir, pos) * freq + wave_time * phase) + 1) / 2, k - 1) * cos(dot(wave_dir, pos) * freq + wave_time * phase);
-    float dx = wave_dir[0] * basis;
-    float dy = wave_dir[1] * basis;
-    return vec4(-dx, 1, -dy, 0.0);
+
+/* wave packets, rasterized over [packet_lo, packet_hi] as (-dh/dx, h, -dh/dz) */
+void packet_surface(float x, float y, inout vec4 offset, inout vec4 norm) {
+    vec4 p = textureLod(packet_tile, (vec2(x, y) - packet_lo) / (packet_hi - packet_lo), 0.0);
+    offset.y += p.y;
+    // A true slope against the y the waves summed, so it survives normalize
+    float scale = max(norm.y, 1.0);
+    norm += vec4(p.x * scale, 0.0, p.z * scale, 0.0);
 }
 
-vec4 wave_offset(float x, float y) {
-    float y_shift = 0;
-    for (int i = 0; i < wave_cnt; ++i) {
-        float A = waves[i].A;
-        float freq = 2 / waves[i].L;
-        float phase = 2 / waves[i].L * waves[i].S;
-        float shift = waves[i].K;
-        y_shift += single_wave_offset(waves[i].dir, vec2(x, y), A, freq, phase, shift);
-    }
+/* 1 for waves of angular wavenumber freq with a quarter wavelength or more
+   per sample `spacing` apart, down to 0 at the Nyquist limit of half a
+   wavelength; as fluid::wave_lod */
+float wave_lod(float freq, float spacing) {
+    return clamp(2.0 - 2.0 * spacing * freq / M_PI, 0.0, 1.0);
+}
 
-    return vec4(0.0f, y_shift, 0.0f, 0.0f);
+/* mean of ((sin + 1) / 2)^k over a period, C(2k, k) / 4^k for whole k;
+   as fluid::wave_mean */
+float wave_mean(float k) {
+    float mean = 1.0;
+    for (int j = 1; j <= int(k); ++j) {
+        mean *= (2.0 * j - 1.0) / (2.0 * j);
+    }
+    return mean;
 }
-vec4 wave_normal(float x, float y) {
-    vec4 norm = vec4(0.0);
 
+/* spacing: world units between the samples around (x, y), 0 for every wave */
+void wave_surface(float x, float y, float spacing, inout vec4 offset, inout vec4 norm) {
+    if (spectral) {
+        // FFT ocean tile of (-dh/dx, h, -dh/dz), sample (i, j) at (i, j) * size / N;
+        // the mip whose texels are as far apart as the samples
+        vec2 texels = vec2(textureSize(spectral_tile, 0));
+        vec2 uv = vec2(x, y) / spectral_size + 0.5 / texels;
+        float lod = max(log2(spacing * texels.x / spectral_size), 0.0);
+        vec4 s = textureLod(spectral_tile, uv, lod);
+        offset.y += s.y;
+        norm += vec4(s.x, 1, s.z, 0.0);
+        if (packets) packet_surface(x, y, offset, norm);
+        return;
+    }
+    float y_shift = 0;
     for (int i = 0; i < wave_cnt; ++i) {
-        float A = waves[i].A;
         float freq = 2 / waves[i].L;
+        float fade = wave_lod(freq, spacing);
+        // faded toward its mean, so distant water keeps its level
+        y_shift += 2 * waves[i].A * (1.0 - fade) * wave_mean(waves[i].K);
+        if (fade == 0.0) {
+            // keeps the y it would have added, so the normal does not change scale
+            norm.y += 1;
+            continue;
+        }
+        float A = waves[i].A * fade;
         float phase = 2 / waves[i].L * waves[i].S;
         float shift = waves[i].K;
-        norm += single_wave_normal(waves[i].dir, vec2(x, y), A, freq, phase, shift);
+        single_wave(waves[i].dir, vec2(x, y), A, freq, phase, shift, y_shift, norm);
     }
-
-    return norm;
+    offset.y += y_shift;
+    if (packets) packet_surface(x, y, offset, norm);
 })zzz";
 
 
@@ -99,6 +123,7 @@ void main() {
 const char* cob_vs =
 R"zzz(#version 410 core
 uniform mat4 view;
+uniform mat4 unpack;
 uniform vec4 w_lpos;
 
 in vec4 w_pos;
@@ -107,9 +132,9 @@ out vec4 v_v_from_ldir;
 out vec4 v_w_pos;
 
 void main() {
-	v_w_pos = w_pos;
-    gl_Position = view * w_pos;
-    v_v_from_ldir = view * (w_pos - w_lpos);
+	v_w_pos = unpack * w_pos;
+    gl_Position = view * v_w_pos;
+    v_v_from_ldir = view * (v_w_pos - w_lpos);
 })zzz";
 
 /*** convert to view basis and shift by model ***/
@@ -117,15 +142,70 @@ const char* cob_model_vs =
 R"zzz(#version 410 core
 uniform mat4 view;
 uniform mat4 model;
+uniform mat4 unpack;
+uniform vec4 w_lpos;
+
+in vec4 w_pos;
+
+out vec4 v_v_from_ldir;
+out vec4 v_w_pos;
+
+void main() {
+	v_w_pos = model * unpack * w_pos;
+    gl_Position = view * v_w_pos;
+    v_v_from_ldir = view * (v_w_pos - w_lpos);
+})zzz";
+
+/*** convert to view basis and shift by model, passing per vertex normals on ***/
+const char* cob_model_norm_vs =
+R"zzz(#version 410 core
+uniform mat4 view;
+uniform mat4 model;
+uniform mat4 unpack;
 uniform vec4 w_lpos;
+uniform bool packed_normals;
 
 in vec4 w_pos;
+in vec4 normal;
 
 out vec4 v_v_from_ldir;
 out vec4 v_w_pos;
+out vec4 v_v_norm;
+
+// octahedral normal, two 16-bit integers
+vec3 oct_decode(vec2 q) {
+	vec2 p = q / 32767.0;
+	vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(p.yx)) * vec2(p.x < 0.0 ? -1.0 : 1.0, p.y < 0.0 ? -1.0 : 1.0);
+	}
+	return normalize(n);
+}
 
 void main() {
-	v_w_pos = model * w_pos;
+	v_w_pos = model * unpack * w_pos;
+    gl_Position = view * v_w_pos;
+    v_v_from_ldir = view * (v_w_pos - w_lpos);
+    vec3 n = packed_normals ? oct_decode(normal.xy) : normal.xyz;
+    v_v_norm = view * model * vec4(n, 0.0);
+})zzz";
+
+/*** place a unit cube instance at its lattice cell, then convert to view basis ***/
+const char* lattice_instance_vs =
+R"zzz(#version 410 core
+uniform mat4 view;
+uniform mat4 unpack;
+uniform vec4 w_lpos;
+uniform float cell_size;
+
+in vec4 w_pos;
+in vec4 cell;
+
+out vec4 v_v_from_ldir;
+out vec4 v_w_pos;
+
+void main() {
+	v_w_pos = vec4(((unpack * w_pos).xyz + 0.5 + cell.xyz) * cell_size - 0.5, 1.0);
     gl_Position = view * v_w_pos;
     v_v_from_ldir = view * (v_w_pos - w_lpos);
 })zzz";
@@ -216,9 +296,13 @@ R"zzz(#version 410 core
 layout (vertices = 4) out;
 uniform float tcs_in_deg;
 uniform float tcs_out_deg;
-uniform float tidal_time;
 
-#define TIDAL_LEFT_T 100.0
+#define MAX_SWELLS 32
+layout (std140) uniform swell_block {
+    ivec4 swell_count;
+    vec4 swells[MAX_SWELLS];
+};
+
 #define MAX_ADAPTIVE 10
 #define TIDAL_DECAY 5
 
@@ -228,16 +312,19 @@ void main(void){
         float in_deg = tcs_in_deg;
         float out_deg = tcs_out_deg;
 
-        // adaptive tessellation
-        if(tidal_time < TIDAL_LEFT_T) {
-            float grid_size = distance(gl_in[0].gl_Position.xyz, gl_in[1].gl_Position.xyz);
-            vec3 grid_center = (gl_in[0].gl_Position.xyz + gl_in[1].gl_Position.xyz + gl_in[2].gl_Position.xyz + gl_in[3].gl_Position.xyz)/4.0;
-            vec2 grid_c = vec2(grid_center[0], grid_center[2]);
-            vec2 tidal_c = vec2(1, 0) * tidal_time + vec2(0, 0);
-            if(distance(grid_c, tidal_c) / grid_size * TIDAL_DECAY < MAX_ADAPTIVE) {
-                in_deg = tcs_in_deg + int(MAX_ADAPTIVE - distance(grid_c, tidal_c) / grid_size * TIDAL_DECAY);
-                out_deg = tcs_out_deg + int(MAX_ADAPTIVE - distance(grid_c, tidal_c) / grid_size * TIDAL_DECAY);
-            }
+        // adaptive tessellation, by the nearest swell that reaches the patch
+        float grid_size = distance(gl_in[0].gl_Position.xyz, gl_in[1].gl_Position.xyz);
+        vec3 grid_center = (gl_in[0].gl_Position.xyz + gl_in[1].gl_Position.xyz + gl_in[2].gl_Position.xyz + gl_in[3].gl_Position.xyz)/4.0;
+        vec2 grid_c = vec2(grid_center[0], grid_center[2]);
+        float nearest = MAX_ADAPTIVE * grid_size / TIDAL_DECAY;
+        for (int i = 0; i < swell_count.x; ++i) {
+            float dist = distance(grid_c, swells[i].xy);
+            // the patch lies within grid_size of its centre
+            if (dist < 4 * swells[i].w + grid_size) nearest = min(nearest, dist);
+        }
+        if(nearest / grid_size * TIDAL_DECAY < MAX_ADAPTIVE) {
+            in_deg = tcs_in_deg + int(MAX_ADAPTIVE - nearest / grid_size * TIDAL_DECAY);
+            out_deg = tcs_out_deg + int(MAX_ADAPTIVE - nearest / grid_size * TIDAL_DECAY);
         }
 
         // set tess levels
@@ -259,7 +346,6 @@ uniform mat4 view;
 uniform vec4 w_lpos;
 uniform float wave_time;
 uniform float wave_type;
-uniform float tidal_time;
 
 out vec4 v_v_from_ldir;
 out vec4 v_v_norm;
@@ -273,34 +359,44 @@ struct wave_params {
 };
 uniform int wave_cnt;
 uniform wave_params waves[20];
+uniform bool spectral;
+uniform sampler2D spectral_tile;
+uniform float spectral_size;
+uniform bool packets;
+uniform sampler2D packet_tile;
+uniform vec2 packet_lo;
+uniform vec2 packet_hi;
+// 2 tan(fov / 2) / viewport height: world units a pixel covers per unit of depth
+uniform float lod_pixel;
 
 #define M_PI 3.1415926535897932384626433832795
-#define TIDAL_LEFT_T 100.0
 
-/* gaussian tidal wave */
-float moving_gaussian_offset(vec2 pos, vec2 dir, vec2 center, float A, float sigma);
-vec4 tidal_offset(float x, float y);
-vec3 moving_gaussian_normal(vec2 pos, vec2 dir, vec2 center, float A, float sigma);
-vec4 tidal_normal(float x, float y);
+#define MAX_SWELLS 32
+layout (std140) uniform swell_block {
+    ivec4 swell_count;
+    vec4 swells[MAX_SWELLS];
+};
+
+/* gaussian swells */
+void moving_gaussian(vec2 pos, vec4 swell, inout vec4 offset, inout vec4 norm);
+void tidal_surface(float x, float y, inout vec4 offset, inout vec4 norm);
 
 /* regular small waves */
-float single_wave_offset(vec2 wave_dir, vec2 pos, float A, float freq, float phase, float k);
-vec4 single_wave_normal(vec2 wave_dir, vec2 pos, float A, float freq, float phase, float k);
-vec4 wave_offset(float x, float y);
-vec4 wave_normal(float x, float y);
+void single_wave(vec2 wave_dir, vec2 pos, float A, float freq, float phase, float k, inout float y_shift, inout vec4 norm);
+void wave_surface(float x, float y, float spacing, inout vec4 offset, inout vec4 norm);
 
 void main(void) {
 	vec4 p1 = mix(gl_in[0].gl_Position, gl_in[3].gl_Position, gl_TessCoord.x);
 	vec4 p2 = mix(gl_in[1].gl_Position, gl_in[2].gl_Position, gl_TessCoord.x);
     vec4 w_pos = mix(p1, p2, gl_TessCoord.y);
 
-    w_pos += wave_offset(w_pos[0], w_pos[2]);
-    vec4 w_norm = wave_normal(w_pos[0], w_pos[2]); // assumes original norm is 0
-
-    if(tidal_time < TIDAL_LEFT_T) {
-        w_pos += tidal_offset(w_pos[0], w_pos[2]);
-        w_norm += tidal_normal(w_pos[0], w_pos[2]);
-    }
+    vec4 w_norm = vec4(0.0); // assumes original norm is 0
+    vec2 plane_pos = vec2(w_pos[0], w_pos[2]);
+    // Waves shorter than the vertices (or pixels) can show only alias
+    float spacing = max(distance(gl_in[0].gl_Position, gl_in[1].gl_Position) / gl_TessLevelInner[0],
+                        -(view * w_pos).z * lod_pixel);
+    wave_surface(plane_pos[0], plane_pos[1], spacing, w_pos, w_norm);
+    tidal_surface(plane_pos[0], plane_pos[1], w_pos, w_norm);
     w_norm = normalize(w_norm);
 
 
@@ -476,6 +572,36 @@ void main() {
     }
 })zzz";
 
+/*** frag col = norm ^ 2 w/ light incidence, optionally w/ the menger lattice drawn on top ***/
+const char* lattice_orient_fs =
+R"zzz(#version 330 core
+uniform mat4 view;
+uniform bool render_cells;
+uniform float cell_size;
+
+flat in vec4 v_norm;
+flat in vec4 w_norm;
+
+in vec4 v_from_ldir;
+in vec4 w_pos;
+
+out vec4 frag_col;
+
+void main() {
+    // distance to the nearest cell border in pixels, ignoring the axis the face is normal to
+    vec3 cell = (w_pos.xyz + 0.5) / cell_size;
+    vec3 border = abs(cell - round(cell)) / fwidth(cell);
+    border = mix(border, vec3(1e9), step(0.5, abs(w_norm.xyz)));
+    if (render_cells && min(min(border.x, border.y), border.z) < 1.0) {
+        frag_col = vec4(0.0, 1.0, 0.0, 1.0);
+    } else {
+        vec4 base_col = clamp(w_norm * w_norm, 0.0, 1.0);
+        float intensity = clamp(-dot(v_from_ldir, v_norm), 0.0, 1.0);
+        frag_col = clamp(intensity * base_col, 0.0, 1.0);
+        frag_col.a = 1.0;
+    }
+})zzz";
+
 /*** frag col = checkboard on xz plane w/ light incidence ***/
 const char* wireframe_checker_fs =
 R"zzz(#version 330 core
@@ -574,7 +700,6 @@ void main() {
 std::string _wireframe_seabed_fs = std::string(
 R"zzz(#version 330 core
 uniform bool render_wireframe;
-uniform float tidal_time;
 uniform float wave_time;
 
 struct wave_params {
@@ -586,6 +711,13 @@ struct wave_params {
 };
 uniform int wave_cnt;
 uniform wave_params waves[20];
+uniform bool spectral;
+uniform sampler2D spectral_tile;
+uniform float spectral_size;
+uniform bool packets;
+uniform sampler2D packet_tile;
+uniform vec2 packet_lo;
+uniform vec2 packet_hi;
 
 flat in vec4 v_norm;
 
@@ -595,16 +727,19 @@ in vec3 edge_dist;
 
 out vec4 frag_col;
 
-#define TIDAL_LEFT_T 100.0
 #define M_PI 3.1415926535897932384626433832795
 
-/* gaussian tidal wave */
-vec4 tidal_offset(float x, float y);
-vec4 tidal_normal(float x, float y);
+#define MAX_SWELLS 32
+layout (std140) uniform swell_block {
+    ivec4 swell_count;
+    vec4 swells[MAX_SWELLS];
+};
+
+/* gaussian swells */
+void tidal_surface(float x, float y, inout vec4 offset, inout vec4 norm);
 
 /* regular small waves */
-vec4 wave_offset(float x, float y);
-vec4 wave_normal(float x, float y);
+void wave_surface(float x, float y, float spacing, inout vec4 offset, inout vec4 norm);
 
 // float dist = (depth - dot(seabed_norm, lineP)) / (dot(seabed_norm, lineN));
 vec3 seabed_ocean_plane_intercept(vec3 seabed_pos, vec3 ocean_pos,
@@ -629,12 +764,11 @@ void main() {
         frag_col = vec4(0.0, 1.0, 0.0, 1.0);
     } else {
         // get ocean surface right above
-        vec4 ocean_w_pos = wave_offset(w_pos[0], w_pos[2]) + w_pos + vec4(0.0, 4.0, 0.0, 1.0); // TODO: fix depth
-        vec4 ocean_w_norm = wave_normal(w_pos[0], w_pos[2]);
-        if(tidal_time < TIDAL_LEFT_T) {
-            ocean_w_pos += tidal_offset(w_pos[0], w_pos[2]);
-            ocean_w_norm += tidal_normal(w_pos[0], w_pos[2]);
-        }
+        vec4 ocean_w_pos = w_pos + vec4(0.0, 4.0, 0.0, 1.0); // TODO: fix depth
+        vec4 ocean_w_norm = vec4(0.0);
+        float spacing = length(fwidth(w_pos.xz));
+        wave_surface(w_pos[0], w_pos[2], spacing, ocean_w_pos, ocean_w_norm);
+        tidal_surface(w_pos[0], w_pos[2], ocean_w_pos, ocean_w_norm);
         ocean_w_norm = normalize(ocean_w_norm);
 
         // get \"light plane\" map interception
@@ -659,8 +793,14 @@ const char* wireframe_seabed_fs = _wireframe_seabed_fs.c_str();
 const char* menger_vs = cob_vs;
 const char* menger_tcs = nullptr;
 const char* menger_tes = nullptr;
-const char* menger_gs = base_gs;
-const char* menger_fs = base_orient_fs;
+const char* menger_gs = wireframe_gs;
+const char* menger_fs = lattice_orient_fs;
+
+const char* menger_instanced_vs = lattice_instance_vs;
+const char* menger_instanced_tcs = nullptr;
+const char* menger_instanced_tes = nullptr;
+const char* menger_instanced_gs = base_gs;
+const char* menger_instanced_fs = base_orient_fs;
 
 const char* floor_vs = passthrough_vs;
 const char* floor_tcs = simple_tri_tcs;
@@ -680,7 +820,7 @@ const char* light_tes = nullptr;
 const char* light_gs = wireframe_gs;
 const char* light_fs = emissive_fs;
 
-const char* ship_vs = cob_model_vs;
+const char* ship_vs = cob_model_norm_vs;
 const char* ship_tcs = nullptr;
 const char* ship_tes = nullptr;
 const char* ship_gs = phong_norm_gs;
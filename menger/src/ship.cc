@@ -1,95 +1,134 @@
 #include "ship.h"
 
 #include "fluid.h"
+#include "meshcache.h"
+#include "meshio.h"
 #include "sphere.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
+#include <sys/stat.h>
 
-void ship::generate_geometry(std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces) {
-    //TODO load obj file
-    sphere::create_sphere(1.0, 15, 15, obj_vertices, obj_faces);
-
-    std::string line_buf;
-    std::ifstream boat;
-    boat.open("boat.obj");
-    if(!boat.good()) return;
-    std::vector<glm::vec4> verts;
-    std::vector<glm::vec4> norms;
-    std::vector<glm::vec2> tex_coord;
-    std::vector<glm::uvec3> faces;
+namespace {
+    // Bump whenever the parsing or post-processing below changes
+    const uint32_t kShipVersion = 2;
+}
 
+void ship::generate_geometry(std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces,
+        std::vector<glm::vec4>& obj_normals) {
+    // a sphere stands in when there is no boat.obj
     obj_vertices.clear();
     obj_faces.clear();
+    sphere::create_sphere(1.0, 15, 15, obj_vertices, obj_faces);
+    obj_normals.clear();
+    for (const auto& vertex : obj_vertices) {
+        obj_normals.push_back(glm::vec4(glm::normalize(glm::vec3(vertex)), 0.0f));
+    }
 
-    while (!boat.eof()) {
-        getline(boat, line_buf);
-        std::stringstream ss;
-        if (line_buf.compare(0, 2, "v ") == 0) {
-            ss << line_buf.substr(2);
-            float x, y, z;
-            ss >> x >> y >> z;
-            verts.push_back(glm::vec4(x * 2.0f, y * 2.5f, z * 2.0f, 1.0f));
-        } else if (line_buf.compare(0, 3, "vn ") == 0) {
-            ss << line_buf.substr(3);
-            float x, y, z;
-            ss >> x >> y >> z;
-            norms.push_back(glm::vec4(x, y, z, 0.0f));
-        } else if (line_buf.compare(0, 3, "vt ") == 0) {
-            ss << line_buf.substr(3);
-            float u, v;
-            ss >> u >> v;
-            tex_coord.push_back(glm::vec2(u, v));
-        } else if (line_buf.compare(0, 2, "f ") == 0) {
-            ss << line_buf.substr(2);
-            unsigned int v0, n0, t0, v1, n1, t1, v2, n2, t2;
-            char tossaway;
-            ss >> v0 >> tossaway >> t0 >> tossaway >> n0
-                >> v1 >> tossaway >> t1 >> tossaway >> n1
-                >> v2 >> tossaway >> t2 >> tossaway >> n2;
-            faces.push_back(glm::uvec3(v0, v1, v2) - glm::uvec3(1.0));
-        }
+    // the parsed boat is cached until boat.obj changes
+    struct stat boat_stat;
+    if (stat("boat.obj", &boat_stat) != 0) return;
+    const uint64_t stamp[] = {kShipVersion, uint64_t(boat_stat.st_size), uint64_t(boat_stat.st_mtime)};
+    const uint64_t params = meshcache::hash(stamp, sizeof(stamp));
+    std::vector<glm::vec4> cached_vertices, cached_normals;
+    std::vector<glm::uvec3> cached_faces, no_faces;
+    if (meshcache::load("ship", params, cached_vertices, cached_faces)
+            && meshcache::load("ship-normals", params, cached_normals, no_faces)
+            && cached_normals.size() == cached_vertices.size()) {
+        obj_vertices.swap(cached_vertices);
+        obj_faces.swap(cached_faces);
+        obj_normals.swap(cached_normals);
+        return;
     }
-    boat.close();
 
-    obj_vertices.insert(obj_vertices.end(), verts.begin(), verts.end());
-    obj_faces.insert(obj_faces.end(), faces.begin(), faces.end());
+    meshio::obj_mesh boat;
+    if (!meshio::load_obj("boat.obj", boat)) return;
 
-    glm::vec4 sum = glm::vec4(0.0f);
-    for (auto vertex : obj_vertices) {
-        sum += vertex;
-        sum *= 0.5f;
+    // stretch the hull, and its normals by the inverse, then center it on
+    // the xz plane
+    const glm::vec3 stretch(2.0f, 2.5f, 2.0f);
+    glm::vec4 center(0.0f);
+    for (auto& vertex : boat.vertices) {
+        vertex = glm::vec4(glm::vec3(vertex) * stretch, 1.0f);
+        center += vertex;
     }
-    sum[3] = 0.0f;
-    sum[1] = 0.0f;
-    for (auto& vertex : obj_vertices) {
-        vertex -= sum;
+    center /= float(std::max<size_t>(1, boat.vertices.size()));
+    center[1] = 0.0f;
+    center[3] = 0.0f;
+    for (auto& vertex : boat.vertices) {
+        vertex -= center;
     }
+    for (auto& normal : boat.normals) {
+        normal = glm::vec4(glm::normalize(glm::vec3(normal) / stretch), 0.0f);
+    }
+
+    obj_vertices.swap(boat.vertices);
+    obj_faces.swap(boat.faces);
+    obj_normals.swap(boat.normals);
+    meshcache::save("ship", params, obj_vertices, obj_faces);
+    meshcache::save("ship-normals", params, obj_normals, no_faces);
 }
-glm::mat4 ship::model_matrix(double t, ship::instance& inst, fluid::ocean_surf_params params) {
-    auto base = glm::mat4(1.0f);
-    auto plane_pos = glm::vec2 { inst.w_pos[0], inst.w_pos[1] };
 
-    base = glm::translate(base, glm::vec3(fluid::simulate_offset(t, plane_pos, params) + inst.w_pos));
+namespace {
+    // Sits the ship on the surface at `height`, tilted onto `normal`
+    glm::mat4 place(const ship::instance& inst, float height, const glm::vec4& normal) {
+        auto base = glm::mat4(1.0f);
+        base = glm::translate(base, glm::vec3(glm::vec4(0.0f, height, 0.0f, 0.0f) + inst.w_pos));
 
-    auto norm = glm::normalize(glm::vec3(fluid::simulate_normal(t, plane_pos, params)));
-    auto rot_axis = glm::cross(inst.up, norm);
-    auto rot_theta = glm::acos(glm::dot(inst.up, norm));
-    if (glm::length(rot_axis) > 0.000001) {
-        base = glm::rotate(base, rot_theta, rot_axis);
-    }
+        auto norm = glm::normalize(glm::vec3(normal));
+        auto rot_axis = glm::cross(inst.up, norm);
+        auto rot_theta = glm::acos(glm::dot(inst.up, norm));
+        if (glm::length(rot_axis) > 0.000001) {
+            base = glm::rotate(base, rot_theta, rot_axis);
+        }
 
-    auto forw_rot_axis = glm::vec3(0.0f, 1.0f, 0.0f);
-    auto forw_rot_theta = glm::acos(glm::dot(inst.up, inst.forw));
-    if (glm::length(forw_rot_axis) > 0.000001) {
-        base = glm::rotate(base, forw_rot_theta, forw_rot_axis);
+        auto forw_rot_axis = glm::vec3(0.0f, 1.0f, 0.0f);
+        auto forw_rot_theta = glm::acos(glm::dot(inst.up, inst.forw));
+        if (glm::length(forw_rot_axis) > 0.000001) {
+            base = glm::rotate(base, forw_rot_theta, forw_rot_axis);
+        }
+
+        return base;
     }
+}
 
-    return base;
+glm::mat4 ship::model_matrix(double t, ship::instance& inst, fluid::ocean_surf_params params) {
+    auto surface = fluid::simulate_surface(t, glm::vec2 { inst.w_pos[0], inst.w_pos[2] }, params);
+    return place(inst, surface.offset[1], surface.normal);
+}
+void ship::model_matrices(double t, const std::vector<instance>& insts, const fluid::ocean_surf_params& params,
+        std::vector<glm::mat4>& out) {
+    std::vector<float> x(insts.size()), z(insts.size()), heights(insts.size());
+    std::vector<glm::vec4> normals(insts.size());
+    for (size_t i = 0; i < insts.size(); ++i) {
+        x[i] = insts[i].w_pos[0];
+        z[i] = insts[i].w_pos[2];
+    }
+    fluid::simulate_batch(fluid::make_wave_bank(t, params), x.data(), z.data(), insts.size(),
+        heights.data(), normals.data());
+    out.resize(insts.size());
+    for (size_t i = 0; i < insts.size(); ++i) {
+        out[i] = place(insts[i], heights[i], normals[i]);
+    }
+}
+void ship::model_matrices(const std::vector<instance>& insts, fluid::heightfield& surface,
+        std::vector<glm::mat4>& out) {
+    out.resize(insts.size());
+    for (size_t i = 0; i < insts.size(); ++i) {
+        const fluid::surface_sample sample = surface.sample(glm::vec2(insts[i].w_pos[0], insts[i].w_pos[2]));
+        out[i] = place(insts[i], sample.offset[1], sample.normal);
+    }
+}
+void ship::model_matrices(const std::vector<instance>& insts, const fluid::spectral_ocean& surface,
+        std::vector<glm::mat4>& out) {
+    out.resize(insts.size());
+    for (size_t i = 0; i < insts.size(); ++i) {
+        const fluid::surface_sample sample = surface.sample(glm::vec2(insts[i].w_pos[0], insts[i].w_pos[2]));
+        out[i] = place(insts[i], sample.offset[1], sample.normal);
+    }
 }
 void ship::instance::simulate(double dt, std::vector<ship::instance>& fellow_ships) {
     // TODO change from no op
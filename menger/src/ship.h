@@ -5,6 +5,8 @@
 #include <vector>
 
 #include "fluid.h"
+#include "heightfield.h"
+#include "spectral.h"
 
 namespace ship {
     struct instance {
@@ -17,8 +19,18 @@ namespace ship {
         double t_scale = 1000000.0;
         void simulate(double dt, std::vector<instance>& fellow_ships);
     };
-    void generate_geometry(std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces);
+    // Loads boat.obj (or a sphere if it is missing), with one normal per vertex
+    void generate_geometry(std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces,
+        std::vector<glm::vec4>& obj_normals);
     glm::mat4 model_matrix(double t, instance& inst, fluid::ocean_surf_params params);
+    // model_matrix for every ship, with the surface evaluated in one batch
+    void model_matrices(double t, const std::vector<instance>& insts, const fluid::ocean_surf_params& params,
+        std::vector<glm::mat4>& out);
+    // The same, read off a heightfield
+    void model_matrices(const std::vector<instance>& insts, fluid::heightfield& surface, std::vector<glm::mat4>& out);
+    // Or off the last tile of the FFT ocean
+    void model_matrices(const std::vector<instance>& insts, const fluid::spectral_ocean& surface,
+        std::vector<glm::mat4>& out);
 }
 
 #endif
@@ -0,0 +1,299 @@
+#include "spectral.h"
+
+#include "fastmath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+    const float kGravity = 9.81f;
+    const float kPi = 3.14159265358979f;
+
+#if defined(__SSE2__)
+    typedef fastmath::sse2 vec;
+#else
+    typedef fastmath::scalar vec;
+#endif
+
+    // Phillips: A e^(-1 / (k L)^2) / k^4 |k.w|^2 with L = V^2 / g, and the
+    // waves far shorter than L damped
+    float phillips(const glm::vec2& k, const fluid::spectral_params& params) {
+        const float k2 = glm::dot(k, k);
+        if (k2 == 0.0f) return 0.0f;
+        const float L = params.wind_speed * params.wind_speed / kGravity;
+        const float l = L / 1000.0f;
+        const float along = glm::dot(k, glm::normalize(params.wind_dir));
+        return std::exp(-1.0f / (k2 * L * L)) / (k2 * k2) * (along * along / k2) * std::exp(-k2 * l * l);
+    }
+
+    // JONSWAP in frequency, moved to wavenumber with w^2 = g k, and spread
+    // by 2 / pi cos^2 about the wind
+    float jonswap(const glm::vec2& k, const fluid::spectral_params& params) {
+        const float kl = glm::length(k);
+        if (kl == 0.0f) return 0.0f;
+        const float c = glm::dot(k, glm::normalize(params.wind_dir)) / kl;
+        if (c <= 0.0f) return 0.0f;
+        const float omega = std::sqrt(kGravity * kl);
+        const float peak = 22.0f * std::cbrt(kGravity * kGravity / (params.wind_speed * params.fetch));
+        const float sigma = omega <= peak ? 0.07f : 0.09f;
+        const float d = (omega - peak) / (sigma * peak);
+        const float s = kGravity * kGravity / std::pow(omega, 5.0f) * std::exp(-1.25f * std::pow(peak / omega, 4.0f))
+            * std::pow(params.gamma, std::exp(-0.5f * d * d));
+        const float per_k = s * kGravity / (2.0f * omega);
+        return per_k * (2.0f / kPi) * c * c / kl;
+    }
+
+    int round_up_pow2(int n) {
+        int p = 4;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    // Signed frequency of FFT bin i
+    int bin(int i, int n) {
+        return i < n / 2 ? i : i - n;
+    }
+
+    // Inverse FFT along the rows index for every column of an n x n array.
+    // Each butterfly is the same operation on two whole rows, so it runs
+    // down the columns a vector at a time, and slabs of columns go to
+    // separate threads.
+    void ifft_columns(float* re, float* im, int n, const float* tw_re, const float* tw_im) {
+        const int slab = std::min(n, 64);
+        int bits = 0;
+        while ((1 << bits) < n) ++bits;
+        #pragma omp parallel for schedule(static)
+        for (int c0 = 0; c0 < n; c0 += slab) {
+            for (int r = 0; r < n; ++r) {
+                int rev = 0;
+                for (int b = 0; b < bits; ++b) rev |= ((r >> b) & 1) << (bits - 1 - b);
+                if (r < rev) {
+                    std::swap_ranges(re + r * n + c0, re + r * n + c0 + slab, re + rev * n + c0);
+                    std::swap_ranges(im + r * n + c0, im + r * n + c0 + slab, im + rev * n + c0);
+                }
+            }
+            for (int len = 2; len <= n; len <<= 1) {
+                const int half = len / 2, step = n / len;
+                for (int i = 0; i < n; i += len) {
+                    for (int j = 0; j < half; ++j) {
+                        const vec::reg wr = vec::set1(tw_re[j * step]), wi = vec::set1(tw_im[j * step]);
+                        float* ar = re + (i + j) * n + c0;
+                        float* ai = im + (i + j) * n + c0;
+                        float* br = re + (i + j + half) * n + c0;
+                        float* bi = im + (i + j + half) * n + c0;
+                        for (int c = 0; c < slab; c += vec::width) {
+                            const vec::reg xr = vec::load(br + c), xi = vec::load(bi + c);
+                            const vec::reg tr = vec::sub(vec::mul(xr, wr), vec::mul(xi, wi));
+                            const vec::reg ti = vec::fmadd(xr, wi, vec::mul(xi, wr));
+                            const vec::reg ur = vec::load(ar + c), ui = vec::load(ai + c);
+                            vec::store(ar + c, vec::add(ur, tr));
+                            vec::store(ai + c, vec::add(ui, ti));
+                            vec::store(br + c, vec::sub(ur, tr));
+                            vec::store(bi + c, vec::sub(ui, ti));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void transpose(float* a, int n) {
+        const int block = std::min(n, 32);
+        #pragma omp parallel for schedule(dynamic)
+        for (int bi = 0; bi < n; bi += block) {
+            for (int bj = bi; bj < n; bj += block) {
+                for (int i = bi; i < bi + block; ++i) {
+                    for (int j = (bi == bj ? i + 1 : bj); j < bj + block; ++j) {
+                        std::swap(a[i * n + j], a[j * n + i]);
+                    }
+                }
+            }
+        }
+    }
+
+    void ifft2(std::vector<float>& re, std::vector<float>& im, int n,
+            const std::vector<float>& tw_re, const std::vector<float>& tw_im) {
+        ifft_columns(re.data(), im.data(), n, tw_re.data(), tw_im.data());
+        transpose(re.data(), n);
+        transpose(im.data(), n);
+        ifft_columns(re.data(), im.data(), n, tw_re.data(), tw_im.data());
+        transpose(re.data(), n);
+        transpose(im.data(), n);
+    }
+}
+
+fluid::spectral_ocean::spectral_ocean(const spectral_params& params)
+    : params_(params) {
+    build();
+}
+
+void fluid::spectral_ocean::set_params(const spectral_params& params) {
+    const spectral_params& p = params_;
+    if (params.spectrum == p.spectrum && params.resolution == p.resolution && params.tile_size == p.tile_size
+            && params.wind_dir == p.wind_dir && params.wind_speed == p.wind_speed
+            && params.wave_height == p.wave_height && params.fetch == p.fetch && params.gamma == p.gamma
+            && params.loop_period == p.loop_period && params.seed == p.seed) {
+        return;
+    }
+    params_ = params;
+    build();
+    update(time_);
+}
+
+const fluid::spectral_params& fluid::spectral_ocean::params(void) const {
+    return params_;
+}
+
+void fluid::spectral_ocean::build(void) {
+    params_.resolution = round_up_pow2(params_.resolution);
+    const int n = params_.resolution;
+    const size_t count = size_t(n) * n;
+    const float dk = 2.0f * kPi / params_.tile_size;
+    // Quantized so that every wave, and so the tile, repeats after loop_period
+    const float omega0 = 2.0f * kPi / params_.loop_period;
+
+    std::vector<float> h0_re(count, 0.0f), h0_im(count, 0.0f);
+    std::mt19937 rng(params_.seed);
+    std::normal_distribution<float> gauss;
+    kx_.resize(count);
+    kz_.resize(count);
+    omega_.resize(count);
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            const size_t idx = size_t(j) * n + i;
+            const glm::vec2 k(bin(i, n) * dk, bin(j, n) * dk);
+            kx_[idx] = k.x;
+            kz_[idx] = k.y;
+            omega_[idx] = std::floor(std::sqrt(kGravity * glm::length(k)) / omega0) * omega0;
+            const float xr = gauss(rng), xi = gauss(rng);
+            // The Nyquist row and column have no -k partner to stay real with
+            if (i == n / 2 || j == n / 2) continue;
+            const float p = params_.spectrum == spectrum_type::phillips ? phillips(k, params_) : jonswap(k, params_);
+            const float amp = std::sqrt(p / 2.0f) * dk;
+            h0_re[idx] = xr * amp;
+            h0_im[idx] = xi * amp;
+        }
+    }
+
+    sum_re_.resize(count);
+    sum_im_.resize(count);
+    diff_re_.resize(count);
+    diff_im_.resize(count);
+    double variance = 0.0;
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            const size_t idx = size_t(j) * n + i;
+            const size_t neg = size_t((n - j) % n) * n + (n - i) % n;
+            sum_re_[idx] = h0_re[idx] + h0_re[neg];
+            sum_im_[idx] = h0_im[idx] + h0_im[neg];
+            diff_re_[idx] = h0_re[idx] - h0_re[neg];
+            diff_im_[idx] = h0_im[idx] - h0_im[neg];
+            // |h0(k)|^2 + |h0(-k)|^2 is |h(k, t)|^2 averaged over time, so the
+            // sum is the tile's variance over the loop rather than at t = 0
+            variance += double(h0_re[idx]) * h0_re[idx] + double(h0_im[idx]) * h0_im[idx]
+                + double(h0_re[neg]) * h0_re[neg] + double(h0_im[neg]) * h0_im[neg];
+        }
+    }
+    if (variance > 0.0) {
+        const float scale = float(params_.wave_height / (4.0 * std::sqrt(variance)));
+        for (size_t idx = 0; idx < count; ++idx) {
+            sum_re_[idx] *= scale;
+            sum_im_[idx] *= scale;
+            diff_re_[idx] *= scale;
+            diff_im_[idx] *= scale;
+        }
+    }
+
+    twiddle_re_.resize(n / 2);
+    twiddle_im_.resize(n / 2);
+    for (int j = 0; j < n / 2; ++j) {
+        twiddle_re_[j] = float(std::cos(2.0 * kPi * j / n));
+        twiddle_im_[j] = float(std::sin(2.0 * kPi * j / n));
+    }
+    hx_re_.assign(count, 0.0f);
+    hx_im_.assign(count, 0.0f);
+    z_re_.assign(count, 0.0f);
+    z_im_.assign(count, 0.0f);
+    tile_.assign(count, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+}
+
+void fluid::spectral_ocean::update(double t) {
+    time_ = std::fmod(t, double(params_.loop_period));
+    const int n = params_.resolution;
+    const vec::reg time = vec::set1(float(time_));
+
+    // h(k, t) = h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t), then the height
+    // plus i times the x slope (ik_x h) in one field, and the z slope
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; i += vec::width) {
+            const size_t idx = size_t(j) * n + i;
+            vec::reg s, c;
+            fastmath::sincos<vec>(vec::mul(vec::load(&omega_[idx]), time), s, c);
+            const vec::reg hr = vec::sub(vec::mul(vec::load(&sum_re_[idx]), c), vec::mul(vec::load(&sum_im_[idx]), s));
+            const vec::reg hi = vec::fmadd(vec::load(&diff_re_[idx]), s, vec::mul(vec::load(&diff_im_[idx]), c));
+            const vec::reg kx = vec::load(&kx_[idx]), kz = vec::load(&kz_[idx]);
+            // h + i (i k_x h) = (1 - k_x) h
+            const vec::reg one_kx = vec::sub(vec::set1(1.0f), kx);
+            vec::store(&hx_re_[idx], vec::mul(one_kx, hr));
+            vec::store(&hx_im_[idx], vec::mul(one_kx, hi));
+            vec::store(&z_re_[idx], vec::sub(vec::set1(0.0f), vec::mul(kz, hi)));
+            vec::store(&z_im_[idx], vec::mul(kz, hr));
+        }
+    }
+
+    ifft2(hx_re_, hx_im_, n, twiddle_re_, twiddle_im_);
+    ifft2(z_re_, z_im_, n, twiddle_re_, twiddle_im_);
+
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            const size_t idx = size_t(j) * n + i;
+            tile_[idx] = glm::vec4(-hx_im_[idx], hx_re_[idx], -z_re_[idx], 0.0f);
+        }
+    }
+}
+
+const std::vector<glm::vec4>& fluid::spectral_ocean::tile(void) const {
+    return tile_;
+}
+
+fluid::surface_sample fluid::spectral_ocean::sample(const glm::vec2& pos) const {
+    const int n = params_.resolution;
+    const glm::vec2 grid = pos / params_.tile_size * float(n);
+    const glm::vec2 cell = glm::floor(grid);
+    const float fx = grid.x - cell.x, fz = grid.y - cell.y;
+    // Wrapped into [0, n), negative positions included
+    const int i0 = ((int(cell.x) % n) + n) % n, j0 = ((int(cell.y) % n) + n) % n;
+    const int i1 = (i0 + 1) % n, j1 = (j0 + 1) % n;
+    const glm::vec4 t = tile_[size_t(j0) * n + i0] * ((1 - fx) * (1 - fz)) + tile_[size_t(j0) * n + i1] * (fx * (1 - fz))
+        + tile_[size_t(j1) * n + i0] * ((1 - fx) * fz) + tile_[size_t(j1) * n + i1] * (fx * fz);
+    return {glm::vec4(0.0f, t.y, 0.0f, 0.0f), glm::vec4(t.x, 1.0f, t.z, 0.0f)};
+}
+
+fluid::surface_sample fluid::spectral_ocean::evaluate(const glm::vec2& pos) const {
+    double h = 0.0, sx = 0.0, sz = 0.0;
+    for (size_t idx = 0; idx < omega_.size(); ++idx) {
+        const double wt = double(omega_[idx]) * time_;
+        const double c = std::cos(wt), s = std::sin(wt);
+        const double hr = sum_re_[idx] * c - sum_im_[idx] * s;
+        const double hi = diff_re_[idx] * s + diff_im_[idx] * c;
+        const double phase = double(kx_[idx]) * pos.x + double(kz_[idx]) * pos.y;
+        const double er = std::cos(phase), ei = std::sin(phase);
+        // Real part of h e^(i k.x), and of i k h e^(i k.x)
+        const double re = hr * er - hi * ei, im = hr * ei + hi * er;
+        h += re;
+        sx -= kx_[idx] * im;
+        sz -= kz_[idx] * im;
+    }
+    return {glm::vec4(0.0f, float(h), 0.0f, 0.0f), glm::vec4(float(-sx), 1.0f, float(-sz), 0.0f)};
+}
+
+size_t fluid::spectral_ocean::wave_count(void) const {
+    size_t count = 0;
+    for (size_t idx = 0; idx < sum_re_.size(); ++idx) {
+        if (sum_re_[idx] != 0.0f || sum_im_[idx] != 0.0f || diff_re_[idx] != 0.0f || diff_im_[idx] != 0.0f) ++count;
+    }
+    return count;
+}
@@ -0,0 +1,77 @@
+#ifndef __SPECTRAL_H__
+#define __SPECTRAL_H__
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "fluid.h"
+
+// FFT ocean, after Tessendorf: a periodic tile of heights and slopes
+// synthesized each frame from a wind wave spectrum with an inverse FFT on
+// the CPU. Every frequency on the N x N grid is a wave, so a 256^2 tile sums
+// tens of thousands of waves at O(N^2 log N) per frame, against O(points x
+// waves) for ocean_surf_params. The FFT runs over OpenMP threads with the
+// fastmath.h vector types.
+namespace fluid {
+    enum class spectrum_type { phillips, jonswap };
+
+    struct spectral_params {
+        spectrum_type spectrum = spectrum_type::phillips;
+        // Samples along each side of the tile, a power of two (128 - 512)
+        int resolution = 256;
+        // World units along each side; the tile repeats past it
+        float tile_size = 40.0f;
+        glm::vec2 wind_dir = glm::vec2(1.0f, 0.0f);
+        // m/s; sets the longest waves (Phillips) or the peak (JONSWAP)
+        float wind_speed = 10.0f;
+        // Significant wave height (4 standard deviations) the spectrum is
+        // scaled to, from the variance averaged over time
+        float wave_height = 2.0f;
+        // JONSWAP only: distance the wind has blown over, in m, and the peak
+        // enhancement
+        float fetch = 100000.0f;
+        float gamma = 3.3f;
+        // Seconds after which the tile repeats; frequencies are rounded down
+        // to multiples of 2 pi / loop_period so float time never grows
+        float loop_period = 200.0f;
+        unsigned int seed = 378;
+    };
+
+    class spectral_ocean {
+    public:
+        explicit spectral_ocean(const spectral_params& params = spectral_params());
+
+        // Rebuilds the spectrum (and its random phases) if anything changed
+        void set_params(const spectral_params& params);
+        const spectral_params& params(void) const;
+
+        // Synthesizes the tile at t seconds
+        void update(double t);
+        // (-dh/dx, h, -dh/dz, 0) at each sample, row by row along z, as it
+        // is uploaded for the shaders
+        const std::vector<glm::vec4>& tile(void) const;
+        // Offset and normal in the simulate_surface form, bilinear between
+        // samples and wrapping around the tile
+        surface_sample sample(const glm::vec2& pos) const;
+        // The same by summing every wave at pos, O(N^2); for checking the FFT
+        surface_sample evaluate(const glm::vec2& pos) const;
+        // Frequencies with a non-zero amplitude
+        size_t wave_count(void) const;
+    private:
+        void build(void);
+
+        spectral_params params_;
+        double time_ = 0;
+        // Per frequency, row by row along kz: wavenumber, angular speed and
+        // h0(k) +- conj(h0(-k)) split into the terms of h(k, t)
+        std::vector<float> kx_, kz_, omega_;
+        std::vector<float> sum_re_, sum_im_, diff_re_, diff_im_;
+        // Inverse FFT twiddles, e^(2 pi i j / N) for j < N / 2
+        std::vector<float> twiddle_re_, twiddle_im_;
+        // Height + i slope x, and slope z
+        std::vector<float> hx_re_, hx_im_, z_re_, z_im_;
+        std::vector<glm::vec4> tile_;
+    };
+}
+
+#endif
@@ -1,8 +1,12 @@
 #include "sphere.h"
 
+#include "meshcache.h"
+
 #include <glm/gtc/constants.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <cstring>
 #include <iostream>
+#include <string>
 
 // {upper, lower}
 std::vector<glm::uvec2> base_shifts[2] = {std::vector<glm::uvec2>({
@@ -15,7 +19,20 @@ std::vector<glm::uvec2> base_shifts[2] = {std::vector<glm::uvec2>({
     glm::uvec2(1, 0)
 })};
 
+namespace {
+    // Bump whenever the generated sphere changes
+    const uint32_t kSphereVersion = 1;
+}
+
 void sphere::create_sphere(float radius, int spoke_cnt, int tier_cnt, std::vector<glm::vec4>& obj_vertices, std::vector<glm::uvec3>& obj_faces) {
+    // only spheres built from scratch are cached, since face indices start at 0
+    const bool cacheable = obj_vertices.empty();
+    const std::string cache_name = "sphere-" + std::to_string(radius) + "-" + std::to_string(spoke_cnt) + "x" + std::to_string(tier_cnt);
+    uint32_t params[] = {kSphereVersion, 0, uint32_t(spoke_cnt), uint32_t(tier_cnt)};
+    std::memcpy(&params[1], &radius, sizeof(radius));
+    const uint64_t params_hash = meshcache::hash(params, sizeof(params));
+    if (cacheable && meshcache::load(cache_name, params_hash, obj_vertices, obj_faces)) return;
+
     for (int hu = 1; hu < tier_cnt - 1; ++hu) { // angle about z-axis
         double pitch_angle = hu * glm::pi<double>() / (tier_cnt - 1) + glm::pi<double>() / 2;
         for (int tu = 0; tu < spoke_cnt; ++tu) { // angle about y-axis
@@ -60,4 +77,7 @@ void sphere::create_sphere(float radius, int spoke_cnt, int tier_cnt, std::vecto
         obj_faces.push_back(topface);
         obj_faces.push_back(botface);
     }
+    if (cacheable) {
+        meshcache::save(cache_name, params_hash, obj_vertices, obj_faces);
+    }
 }